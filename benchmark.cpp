@@ -0,0 +1,300 @@
+/*
+ *      Benchmarks of the hot paths of the algorithm proposed in:
+ *
+ *      Weighted Linde-Buzo Gray Stippling
+ *      Oliver Deussen, Marc Spicker, Qian Zheng
+ *
+ *      In: ACM Transactions on Graphics (Proceedings of SIGGRAPH Asia 2017)
+ *      https://doi.org/10.1145/3130800.3130819
+ *
+ *     Copyright 2017 Marc Spicker (marc.spicker@googlemail.com)
+ */
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QGuiApplication>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include "densityfield.h"
+#include "lbgstippling.h"
+#include "stopwatch.h"
+#include "voronoicell.h"
+#include "voronoidiagram.h"
+
+namespace {
+
+using Backend = VoronoiDiagram::Backend;
+
+// Below this many pixels per stipple a combination is skipped.
+const int minPixelsPerStipple = 4;
+
+// Runs f once to warm up, unless cold, and then repeat times. setup runs
+// before every call and is not timed.
+QJsonObject measure(int repeat, const std::function<void()> &setup,
+                    const std::function<void()> &f, bool cold = false) {
+  if (!cold) {
+    setup();
+    f();
+  }
+
+  std::vector<double> times;
+  for (int i = 0; i < repeat; ++i) {
+    setup();
+    Stopwatch stopwatch;
+    f();
+    times.push_back(stopwatch.elapsed());
+  }
+  std::sort(times.begin(), times.end());
+
+  double sum = 0.0;
+  for (double t : times) sum += t;
+  return {{"minMs", times.front()},
+          {"medianMs", times[times.size() / 2]},
+          {"meanMs", sum / times.size()}};
+}
+
+QJsonObject measure(int repeat, const std::function<void()> &f) {
+  return measure(repeat, []() {}, f);
+}
+
+// Dark in the center and light at the corners, so that cells vary in size.
+std::vector<uchar> radialGradient(int32_t width, int32_t height) {
+  std::vector<uchar> pixels(size_t(width) * height);
+  const float maxDistance = std::hypot(width / 2.0f, height / 2.0f);
+  for (int32_t y = 0; y < height; ++y) {
+    for (int32_t x = 0; x < width; ++x) {
+      const float d = std::hypot(x - width / 2.0f, y - height / 2.0f);
+      pixels[size_t(y) * width + x] = uchar(255.0f * d / maxDistance);
+    }
+  }
+  return pixels;
+}
+
+QVector<QVector2D> randomSites(int count, std::mt19937 &gen) {
+  std::uniform_real_distribution<float> dis(0.01f, 0.99f);
+  QVector<QVector2D> sites(count);
+  for (QVector2D &s : sites) s = QVector2D(dis(gen), dis(gen));
+  return sites;
+}
+
+// calculate, accumulateCells, calculateCells and the split and merge step on
+// random sites over a synthetic density.
+void benchmarkKernels(Backend backend, const QString &backendName,
+                      const QList<int> &sizes, const QList<int> &counts,
+                      int repeat, QJsonArray &results) {
+  std::mt19937 gen(42);
+
+  for (int size : sizes) {
+    const std::vector<uchar> pixels = radialGradient(size, size);
+    const DensityField density(GrayView{pixels.data(), size, size, size});
+    std::unique_ptr<VoronoiDiagram> voronoi =
+        VoronoiDiagram::create(backend, density);
+
+    for (int count : counts) {
+      if (size_t(count) * minPixelsPerStipple > size_t(size) * size) continue;
+      const QVector<QVector2D> sites = randomSites(count, gen);
+
+      auto result = [&](const QString &name, QJsonObject timing) {
+        timing["benchmark"] = name;
+        timing["backend"] = backendName;
+        timing["width"] = size;
+        timing["height"] = size;
+        timing["stipples"] = count;
+        results.append(timing);
+        qInfo("%s %s %dx%d %d: %.2f ms", qPrintable(name),
+              qPrintable(backendName), size, size, count,
+              timing["medianMs"].toDouble());
+      };
+
+      result("calculate",
+             measure(repeat, [&]() { voronoi->calculate(sites); }));
+
+      // the index map of the OpenGL backend is valid until the next call
+      const IndexMap map = voronoi->calculate(sites);
+      std::vector<VoronoiCell> cells;
+      result("accumulateCells",
+             measure(repeat, [&]() { cells = accumulateCells(map, density); }));
+
+      // reset, so that the CPU backend does not reuse its cached tiles
+      result("calculateCells",
+             measure(repeat, [&]() { voronoi->reset(density); },
+                     [&]() { voronoi->calculateCells(sites, density); }));
+
+      const LBGStippling::Params params;
+      LBGStippling::Status status = {};
+      std::vector<Stipple> stipples;
+      std::vector<uint32_t> origin;
+      result("splitMerge", measure(repeat, [&]() {
+               status.hysteresis = params.hysteresis;
+               LBGStippling::splitMerge(cells, density, 1.0f, params, status,
+                                        gen, stipples, origin);
+             }));
+    }
+  }
+}
+
+// The full stippling of the given images at every supersampling factor. The
+// runs share one pool of Voronoi diagrams and are not warmed up.
+void benchmarkPipeline(Backend backend, const QString &backendName,
+                       const QFileInfoList &inputs,
+                       const QList<int> &superSampling, int repeat,
+                       QJsonArray &results) {
+  LBGStippling stippling;
+  LBGStippling::Status last = {};
+  LBGStippling::Timings phases = {};
+  stippling.setStatusCallback([&](const LBGStippling::Status &status) {
+    last = status;
+    const LBGStippling::Timings &t = status.timings;
+    phases.density += t.density;
+    phases.raster += t.raster;
+    phases.readback += t.readback;
+    phases.accumulate += t.accumulate;
+    phases.splitMerge += t.splitMerge;
+  });
+
+  for (const QFileInfo &input : inputs) {
+    const QImage image(input.filePath());
+    if (image.isNull()) {
+      qWarning("%s: could not read image", qPrintable(input.filePath()));
+      continue;
+    }
+
+    for (int factor : superSampling) {
+      LBGStippling::Params params;
+      params.voronoiBackend = backend;
+      params.superSamplingFactor = factor;
+      params.reportInterval = 0;
+      // the same stipples in every run and every build
+      params.seed = 1;
+
+      QJsonObject timing = measure(
+          repeat, [&]() { phases = {}; },
+          [&]() { stippling.stipple(image, params); }, true);
+      // phase totals and counts of the last run
+      timing["benchmark"] = "stipple";
+      timing["backend"] = backendName;
+      timing["input"] = input.fileName();
+      timing["width"] = image.width();
+      timing["height"] = image.height();
+      timing["superSampling"] = factor;
+      timing["iterations"] = qint64(last.iteration + 1);
+      timing["stipples"] = qint64(last.size);
+      timing["phasesMs"] = QJsonObject{{"density", phases.density},
+                                       {"raster", phases.raster},
+                                       {"readback", phases.readback},
+                                       {"accumulate", phases.accumulate},
+                                       {"splitMerge", phases.splitMerge}};
+      results.append(timing);
+      qInfo("stipple %s %s x%d: %.0f ms", qPrintable(backendName),
+            qPrintable(input.fileName()), factor,
+            timing["medianMs"].toDouble());
+    }
+  }
+  stippling.releaseResources();
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  }
+  QGuiApplication app(argc, argv);
+  app.setApplicationName("LBGStipplingBenchmark");
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Times the Voronoi diagram, the cell accumulation, the split and merge "
+      "step and the full stippling, and writes the results as JSON.");
+  parser.addHelpOption();
+
+  QCommandLineOption outputOption(
+      {"o", "output"}, "JSON output file, defaults to standard output.",
+      "file");
+  QCommandLineOption backendOption("backend",
+                                   "Voronoi backend: cpu, opengl or all.",
+                                   "name", "cpu");
+  QCommandLineOption repeatOption({"r", "repeat"},
+                                  "Timed runs of every benchmark.", "n", "5");
+  QCommandLineOption inputOption("input",
+                                 "Directory with input1.jpg to input4.jpg.",
+                                 "dir", LBG_INPUT_DIR);
+  QCommandLineOption quickOption(
+      "quick", "Small sizes and no supersampling, for a smoke test.");
+  QCommandLineOption noPipelineOption("no-pipeline",
+                                      "Skip the full stippling runs.");
+  parser.addOptions({outputOption, backendOption, repeatOption, inputOption,
+                     quickOption, noPipelineOption});
+  parser.process(app);
+
+  const int repeat = std::max(1, parser.value(repeatOption).toInt());
+  const bool quick = parser.isSet(quickOption);
+
+  const QString backendName = parser.value(backendOption).toLower();
+  QList<QPair<Backend, QString>> backends;
+  if (backendName == "cpu" || backendName == "all") {
+    backends.append(qMakePair(Backend::CPU, QString("cpu")));
+  }
+  if (backendName == "opengl" || backendName == "all") {
+    backends.append(qMakePair(Backend::OpenGL, QString("opengl")));
+  }
+  if (backends.isEmpty()) {
+    qCritical("Unknown backend: %s", qPrintable(backendName));
+    return 1;
+  }
+
+  const QList<int> sizes =
+      quick ? QList<int>{512} : QList<int>{512, 1024, 2048};
+  const QList<int> counts =
+      quick ? QList<int>{1000, 10000}
+            : QList<int>{1000, 10000, 100000, 1000000};
+  const QList<int> superSampling = quick ? QList<int>{1} : QList<int>{1, 2, 3};
+
+  QFileInfoList inputs;
+  for (int i = 1; i <= 4; ++i) {
+    inputs += QFileInfo(QDir(parser.value(inputOption)),
+                        QString("input%1.jpg").arg(i));
+  }
+
+  QJsonArray results;
+  for (const auto &backend : backends) {
+    benchmarkKernels(backend.first, backend.second, sizes, counts, repeat,
+                     results);
+    if (!parser.isSet(noPipelineOption)) {
+      benchmarkPipeline(backend.first, backend.second, inputs, superSampling,
+                        repeat, results);
+    }
+  }
+
+  const QJsonObject report = {
+      {"qtVersion", qVersion()},
+      {"threads", int(std::thread::hardware_concurrency())},
+      {"repeat", repeat},
+      {"results", results}};
+  const QByteArray json = QJsonDocument(report).toJson();
+
+  const QString output = parser.value(outputOption);
+  if (output.isEmpty()) {
+    QFile out;
+    out.open(stdout, QIODevice::WriteOnly);
+    out.write(json);
+  } else {
+    QFile out(output);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate) ||
+        out.write(json) != json.size()) {
+      qCritical("Could not write %s", qPrintable(output));
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,531 @@
+/*
+ *      Command-line batch stippler for the algorithm proposed in:
+ *
+ *      Weighted Linde-Buzo Gray Stippling
+ *      Oliver Deussen, Marc Spicker, Qian Zheng
+ *
+ *      In: ACM Transactions on Graphics (Proceedings of SIGGRAPH Asia 2017)
+ *      https://doi.org/10.1145/3130800.3130819
+ *
+ *     Copyright 2017 Marc Spicker (marc.spicker@googlemail.com)
+ */
+
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFileInfo>
+#include <QGuiApplication>
+#include <QImage>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+
+#include "lbgstippling.h"
+#include "mappedgrayimage.h"
+#include "statustrace.h"
+#include "stipplecache.h"
+#include "stipplecheckpoint.h"
+#include "stippleexport.h"
+#include "tiledstippling.h"
+
+namespace {
+
+const QStringList imageFilters = {"*.png", "*.jpg", "*.jpeg", "*.bmp",
+                                  "*.pgm", "*.tif", "*.tiff"};
+// read by mapping them, falling back to decoding
+const QStringList mappedSuffixes = {"pgm", "tif", "tiff"};
+const QStringList outputFormats = {"svg", "png", "txt"};
+const QStringList traceFormats = {"chrome", "jsonl"};
+
+// Settings shared by all inputs.
+struct Options {
+  QStringList formats;
+  QString traceFormat;
+  // inputs are headerless samples if the size is not empty
+  QSize rawSize;
+  int rawDepth;
+  // continue from the checkpoints next to the outputs
+  bool resume;
+  TiledStippling::Params tiling;
+};
+
+class Task : public QRunnable {
+ public:
+  explicit Task(std::function<void()> run) : m_run(std::move(run)) {}
+  void run() override { m_run(); }
+
+ private:
+  std::function<void()> m_run;
+};
+
+QFileInfoList collectInputs(const QStringList &args, bool raw) {
+  const QStringList filters = raw ? QStringList{"*.raw"} : imageFilters;
+  QFileInfoList inputs;
+  for (const QString &arg : args) {
+    QFileInfo info(arg);
+    if (info.isDir()) {
+      inputs += QDir(arg).entryInfoList(filters, QDir::Files, QDir::Name);
+    } else {
+      inputs += info;
+    }
+  }
+  return inputs;
+}
+
+bool saveStipples(const QString &base, const QStringList &formats,
+                  const std::vector<Stipple> &stipples, const QSize &size) {
+  bool ok = true;
+  for (const QString &format : formats) {
+    const QString path = base + "." + format;
+    bool saved = false;
+    if (format == "svg") {
+      saved = saveStipplesSVG(path, stipples, size);
+    } else if (format == "png") {
+      saved = saveStipplesPNG(path, stipples, size);
+    } else {
+      saved = saveStipplesText(path, stipples, size);
+    }
+    if (!saved) qWarning("%s: could not write", qPrintable(path));
+    ok &= saved;
+  }
+  return ok;
+}
+
+// Gray pixels of an input. Uncompressed files are mapped, so that only the
+// rows being read are loaded, everything else is decoded.
+class GrayInput {
+ public:
+  GrayInput(const QFileInfo &input, const QSize &rawSize, int rawDepth) {
+    const QString path = input.filePath();
+    if (!rawSize.isEmpty()) {
+      m_mapped = std::make_unique<MappedGrayImage>(path, rawSize, rawDepth);
+    } else if (mappedSuffixes.contains(input.suffix().toLower())) {
+      m_mapped = std::make_unique<MappedGrayImage>(path);
+      // e.g. compressed TIFF or plain PGM
+      if (!m_mapped->isValid()) m_mapped.reset();
+    }
+    if (!m_mapped) {
+      m_decoded = QImage(path).convertToFormat(QImage::Format_Grayscale8);
+    }
+  }
+
+  bool isNull() const {
+    return m_mapped ? !m_mapped->isValid() : m_decoded.isNull();
+  }
+  QString errorString() const {
+    return m_mapped ? m_mapped->errorString() : "could not read image";
+  }
+
+  QSize size() const { return m_mapped ? m_mapped->size() : m_decoded.size(); }
+
+  TiledStippling::RegionSource source() const {
+    if (m_mapped) {
+      const MappedGrayImage *mapped = m_mapped.get();
+      return [mapped](const QRect &region, uchar *pixels, int32_t stride) {
+        mapped->read(region, pixels, stride);
+      };
+    }
+    const QImage &gray = m_decoded;
+    return [&gray](const QRect &region, uchar *pixels, int32_t stride) {
+      for (int32_t y = 0; y < region.height(); ++y) {
+        std::memcpy(pixels + std::ptrdiff_t(y) * stride,
+                    gray.constScanLine(region.y() + y) + region.x(),
+                    region.width());
+      }
+    };
+  }
+
+  // The whole image, converted to 8 bit into buffer if there is no view of
+  // the mapped file.
+  GrayView view(std::vector<uchar> &buffer) const {
+    if (!m_mapped) {
+      return {m_decoded.constBits(), m_decoded.width(), m_decoded.height(),
+              m_decoded.bytesPerLine()};
+    }
+    if (m_mapped->hasView()) return m_mapped->view();
+    const QSize size = m_mapped->size();
+    buffer.resize(size_t(size.width()) * size.height());
+    m_mapped->read(QRect(QPoint(0, 0), size), buffer.data(), size.width());
+    return {buffer.data(), size.width(), size.height(), size.width()};
+  }
+
+ private:
+  std::unique_ptr<MappedGrayImage> m_mapped;
+  QImage m_decoded;
+};
+
+// Images larger than a tile are stippled tile by tile, unless the tile size
+// is 0. Checkpoints are written to <name>.lbgs and removed once the outputs
+// are written.
+bool stippleFile(const LBGStippling &shared, const QFileInfo &input,
+                 const QDir &outputDir, const Options &options) {
+  const QStringList &formats = options.formats;
+  const QString &traceFormat = options.traceFormat;
+  const TiledStippling::Params &tiling = options.tiling;
+  const LBGStippling::Params &params = tiling.stippling;
+  const GrayInput gray(input, options.rawSize, options.rawDepth);
+  if (gray.isNull()) {
+    qWarning("%s: %s", qPrintable(input.filePath()),
+             qPrintable(gray.errorString()));
+    return false;
+  }
+
+  bool ok = true;
+  const QString base = outputDir.filePath(input.completeBaseName());
+  const QSize size = gray.size();
+
+  if (tiling.tileSize > 0 &&
+      (size.width() > tiling.tileSize || size.height() > tiling.tileSize)) {
+    if (!traceFormat.isEmpty() || params.checkpointInterval > 0) {
+      qWarning("%s: no trace or checkpoints for tiled images",
+               qPrintable(base));
+    }
+    const std::vector<Stipple> stipples =
+        TiledStippling(shared).stipple(size, gray.source(), tiling);
+    ok &= saveStipples(base, formats, stipples, size);
+    qInfo("%s: %zu stipples in %dx%d tiles", qPrintable(input.filePath()),
+          stipples.size(), tiling.tileSize, tiling.tileSize);
+    return ok;
+  }
+
+  // a copy for the callback, it still shares the pool of Voronoi diagrams
+  LBGStippling stippling = shared;
+  std::unique_ptr<StatusTrace> trace;
+  if (!traceFormat.isEmpty()) {
+    const bool chrome = traceFormat == "chrome";
+    trace = std::make_unique<StatusTrace>(
+        base + (chrome ? ".trace.json" : ".jsonl"),
+        chrome ? StatusTrace::Format::ChromeTrace
+               : StatusTrace::Format::JsonLines);
+    if (!trace->isOpen()) {
+      qWarning("%s: could not write trace", qPrintable(base));
+      ok = false;
+    }
+    stippling.setStatusCallback(
+        [&trace](const LBGStippling::Status &status) { trace->write(status); });
+  }
+
+  const QString checkpointPath = base + ".lbgs";
+  if (params.checkpointInterval > 0) {
+    stippling.setCheckpointCallback(
+        [&](const LBGStippling::Checkpoint &checkpoint) {
+          if (!saveCheckpoint(checkpointPath, checkpoint)) {
+            qWarning("%s: could not write", qPrintable(checkpointPath));
+          }
+        });
+  }
+
+  LBGStippling::Checkpoint checkpoint;
+  const bool resume = options.resume && QFileInfo::exists(checkpointPath);
+  if (resume && !loadCheckpoint(checkpointPath, checkpoint)) {
+    qWarning("%s: could not read checkpoint", qPrintable(checkpointPath));
+    return false;
+  }
+
+  std::vector<uchar> buffer;
+  std::vector<Stipple> stipples;
+  const LBGStippling::Status status =
+      resume ? stippling.resume(gray.view(buffer), checkpoint, params,
+                                stipples)
+             : stippling.stipple(gray.view(buffer), params, stipples);
+  ok &= saveStipples(base, formats, stipples, size);
+  if (ok && (resume || params.checkpointInterval > 0)) {
+    QFile::remove(checkpointPath);
+  }
+  if (resume) {
+    qInfo("%s: resumed at iteration %zu", qPrintable(input.filePath()),
+          checkpoint.iteration);
+  }
+  qInfo("%s: %zu stipples%s", qPrintable(input.filePath()), stipples.size(),
+        status.converged ? "" : ", not converged");
+  return ok;
+}
+
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  // runs on machines without a display unless a platform is chosen explicitly
+  if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  }
+  QGuiApplication app(argc, argv);
+  app.setApplicationName("LBGStipplingCLI");
+
+  const LBGStippling::Params defaults;
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription(
+      "Weighted Linde-Buzo-Gray Stippling of images or directories of images.");
+  parser.addHelpOption();
+  parser.addPositionalArgument("inputs", "Image files or directories.",
+                               "<inputs...>");
+
+  QCommandLineOption outputOption(
+      {"o", "output"},
+      "Output directory, defaults to the directory of each input.", "dir");
+  QCommandLineOption formatOption(
+      {"f", "format"}, "Comma separated output formats: svg, png, txt.",
+      "formats", "svg");
+  QCommandLineOption jobsOption(
+      {"j", "jobs"},
+      "Number of images stippled at once. Each image also spreads its "
+      "Voronoi diagram over all cores.",
+      "n", "2");
+  QCommandLineOption backendOption("backend",
+                                   "Voronoi backend: cpu or opengl. OpenGL "
+                                   "jobs run one after another.",
+                                   "name", "cpu");
+  QCommandLineOption traceOption(
+      "trace",
+      "Write per-iteration timings and counters next to the outputs, as a "
+      "Chrome trace (<name>.trace.json) or as JSON lines (<name>.jsonl).",
+      "chrome|jsonl");
+  QCommandLineOption checkpointOption(
+      "checkpoint-interval",
+      "Write the state of the run to <name>.lbgs every n iterations, 0 for "
+      "never. The file is removed once the outputs are written.",
+      "n", "0");
+  QCommandLineOption resumeOption(
+      "resume",
+      "Continue from <name>.lbgs where it exists, with the given parameters.");
+  QCommandLineOption cacheOption(
+      "cache",
+      "Reuse finished results of the same image and parameters stored in this "
+      "directory, and store new ones there. Needs a --seed other than 0.",
+      "dir");
+  QCommandLineOption initialPointsOption(
+      "initial-points", "Number of initial stipples.", "n",
+      QString::number(defaults.initialPoints));
+  QCommandLineOption densityInitOption(
+      "density-init",
+      "Start from the estimated final number of stipples, at least the "
+      "initial points, placed according to the density.");
+  QCommandLineOption initialPointSizeOption(
+      "initial-point-size", "Stipple size if the size is not adaptive.",
+      "size", QString::number(defaults.initialPointSize));
+  QCommandLineOption fixedPointSizeOption(
+      "fixed-point-size", "Use the initial point size for all stipples.");
+  QCommandLineOption pointSizeMinOption(
+      "point-size-min", "Smallest adaptive stipple size.", "size",
+      QString::number(defaults.pointSizeMin));
+  QCommandLineOption pointSizeMaxOption(
+      "point-size-max", "Largest adaptive stipple size.", "size",
+      QString::number(defaults.pointSizeMax));
+  QCommandLineOption superSamplingOption(
+      "super-sampling", "Super-sampling factor of the Voronoi diagram, 1 to 3.",
+      "factor", QString::number(defaults.superSamplingFactor));
+  QCommandLineOption maxIterationsOption(
+      "max-iterations", "Maximum number of iterations.", "n",
+      QString::number(defaults.maxIterations));
+  QCommandLineOption hysteresisOption("hysteresis", "Initial hysteresis.",
+                                      "value",
+                                      QString::number(defaults.hysteresis));
+  QCommandLineOption hysteresisDeltaOption(
+      "hysteresis-delta", "Hysteresis increment per iteration.", "value",
+      QString::number(defaults.hysteresisDelta));
+  QCommandLineOption pyramidLevelsOption(
+      "pyramid-levels", "Number of density pyramid levels.", "n",
+      QString::number(defaults.pyramidLevels));
+  QCommandLineOption levelUpRateOption(
+      "level-up-rate",
+      "Fraction of split or merged stipples below which the next pyramid "
+      "level is used.",
+      "rate", QString::number(defaults.levelUpRate));
+  QCommandLineOption seedOption(
+      "seed",
+      "Seed of the random numbers, 0 for a new one in every run. The same "
+      "seed and parameters give the same result.",
+      "n", QString::number(defaults.seed));
+  QCommandLineOption timeBudgetOption(
+      "time-budget",
+      "Milliseconds per image, 0 for none. Out of time, the most stable "
+      "result so far is written.",
+      "ms", QString::number(defaults.timeBudgetMs));
+  QCommandLineOption tileSizeOption(
+      "tile-size",
+      "Stipple images larger than this many pixels in tiles of this size, "
+      "0 for never. Bounds the memory needed for very large images.",
+      "pixels", "0");
+  QCommandLineOption haloOption(
+      "halo", "Pixels of the neighboring tiles seen by each tile.", "pixels",
+      QString::number(TiledStippling::Params().halo));
+  QCommandLineOption rawSizeOption(
+      "raw-size",
+      "Read the inputs as headerless row-major gray samples of this size.",
+      "WxH");
+  QCommandLineOption rawDepthOption(
+      "raw-depth", "Bits per raw sample, 8 or 16 (little endian).", "bits",
+      "8");
+  QCommandLineOption unfusedOption(
+      "no-fused-accumulation",
+      "Store the full index map before accumulating the cells.");
+
+  parser.addOptions({outputOption, formatOption, jobsOption, backendOption,
+                     traceOption, checkpointOption, resumeOption,
+                     cacheOption, initialPointsOption, densityInitOption,
+                     initialPointSizeOption, fixedPointSizeOption,
+                     pointSizeMinOption, pointSizeMaxOption,
+                     superSamplingOption, maxIterationsOption,
+                     hysteresisOption, hysteresisDeltaOption,
+                     pyramidLevelsOption, levelUpRateOption, seedOption,
+                     timeBudgetOption, tileSizeOption, haloOption,
+                     rawSizeOption, rawDepthOption, unfusedOption});
+  parser.process(app);
+
+  bool valid = true;
+  auto invalid = [&](const QCommandLineOption &option) {
+    qCritical("Invalid value for --%s: %s", qPrintable(option.names().last()),
+              qPrintable(parser.value(option)));
+    valid = false;
+  };
+  auto number = [&](const QCommandLineOption &option) {
+    bool ok;
+    const double value = parser.value(option).toDouble(&ok);
+    if (!ok || !std::isfinite(value) || value < 0.0) invalid(option);
+    return value;
+  };
+  // rejects signs, fractions and values outside [min, max] instead of
+  // truncating
+  auto integer = [&](const QCommandLineOption &option, qulonglong min,
+                     qulonglong max) {
+    bool ok;
+    const qulonglong value = parser.value(option).toULongLong(&ok);
+    if (!ok || value < min || value > max) {
+      invalid(option);
+      return qulonglong(0);
+    }
+    return value;
+  };
+  const qulonglong maxSize = std::numeric_limits<size_t>::max();
+  const qulonglong maxInt = std::numeric_limits<int>::max();
+
+  LBGStippling::Params params;
+  params.initialPoints = integer(initialPointsOption, 1, maxSize);
+  params.densityInitialization = parser.isSet(densityInitOption);
+  params.initialPointSize = number(initialPointSizeOption);
+  params.adaptivePointSize = !parser.isSet(fixedPointSizeOption);
+  params.pointSizeMin = number(pointSizeMinOption);
+  params.pointSizeMax = number(pointSizeMaxOption);
+  params.superSamplingFactor = integer(superSamplingOption, 1, 3);
+  params.maxIterations = integer(maxIterationsOption, 0, maxSize);
+  params.hysteresis = number(hysteresisOption);
+  params.hysteresisDelta = number(hysteresisDeltaOption);
+  params.pyramidLevels = integer(pyramidLevelsOption, 0, maxSize);
+  params.levelUpRate = number(levelUpRateOption);
+  params.seed = integer(seedOption, 0, std::numeric_limits<uint32_t>::max());
+  params.timeBudgetMs = integer(timeBudgetOption, 0, maxSize);
+  params.checkpointInterval = integer(checkpointOption, 0, maxSize);
+  params.fusedAccumulation = !parser.isSet(unfusedOption);
+  // nothing to show before the end
+  params.reportInterval = 0;
+  const int jobs =
+      std::max(1, static_cast<int>(integer(jobsOption, 0, maxInt)));
+  const int32_t tileSize = integer(tileSizeOption, 0, maxInt);
+  const int32_t halo = integer(haloOption, 0, maxInt);
+  if (tileSize > 0 && tileSize < 64) {
+    qCritical("Tiles must be at least 64 pixels.");
+    valid = false;
+  }
+
+  QSize rawSize;
+  const int rawDepth = integer(rawDepthOption, 0, maxInt);
+  if (parser.isSet(rawSizeOption)) {
+    const QStringList dims = parser.value(rawSizeOption).split('x');
+    if (dims.size() == 2) rawSize = QSize(dims[0].toInt(), dims[1].toInt());
+    if (rawSize.isEmpty()) {
+      qCritical("Invalid raw size: %s",
+                qPrintable(parser.value(rawSizeOption)));
+      valid = false;
+    }
+  }
+  if (rawDepth != 8 && rawDepth != 16) {
+    qCritical("Raw samples must have 8 or 16 bits.");
+    valid = false;
+  }
+
+  const QString backend = parser.value(backendOption).toLower();
+  if (backend == "cpu") {
+    params.voronoiBackend = VoronoiDiagram::Backend::CPU;
+  } else if (backend == "opengl") {
+    params.voronoiBackend = VoronoiDiagram::Backend::OpenGL;
+  } else {
+    qCritical("Unknown backend: %s", qPrintable(backend));
+    valid = false;
+  }
+
+  const QStringList formats =
+      parser.value(formatOption).toLower().split(',', QString::SkipEmptyParts);
+  for (const QString &format : formats) {
+    if (!outputFormats.contains(format)) {
+      qCritical("Unknown output format: %s", qPrintable(format));
+      valid = false;
+    }
+  }
+
+  const QString traceFormat = parser.value(traceOption).toLower();
+  if (!traceFormat.isEmpty() && !traceFormats.contains(traceFormat)) {
+    qCritical("Unknown trace format: %s", qPrintable(traceFormat));
+    valid = false;
+  }
+
+  const QFileInfoList inputs =
+      collectInputs(parser.positionalArguments(), !rawSize.isEmpty());
+  if (inputs.isEmpty()) {
+    qCritical("No input images given.");
+    valid = false;
+  }
+  if (!valid) return 1;
+
+  const QString output = parser.value(outputOption);
+  if (!output.isEmpty() && !QDir().mkpath(output)) {
+    qCritical("Could not create %s", qPrintable(output));
+    return 1;
+  }
+
+  Options options;
+  options.formats = formats;
+  options.traceFormat = traceFormat;
+  options.rawSize = rawSize;
+  options.rawDepth = rawDepth;
+  options.resume = parser.isSet(resumeOption);
+  options.tiling.stippling = params;
+  options.tiling.tileSize = tileSize;
+  options.tiling.halo = halo;
+  options.tiling.jobs = jobs;
+
+  // one instance for all jobs, so they share its pool of Voronoi diagrams
+  // and its cache
+  LBGStippling stippling;
+  if (parser.isSet(cacheOption)) {
+    if (params.seed == 0) qWarning("The cache is only used with a --seed.");
+    stippling.setCache(
+        std::make_shared<StippleCache>(parser.value(cacheOption)));
+  }
+
+  std::atomic<int> failures(0);
+  auto process = [&](const QFileInfo &input) {
+    const QDir outputDir(output.isEmpty() ? input.absolutePath() : output);
+    if (!stippleFile(stippling, input, outputDir, options)) {
+      ++failures;
+    }
+  };
+
+  if (params.voronoiBackend == VoronoiDiagram::Backend::OpenGL) {
+    // the offscreen surfaces of the OpenGL backend belong to the GUI thread
+    for (const QFileInfo &input : inputs) process(input);
+  } else {
+    QThreadPool pool;
+    pool.setMaxThreadCount(jobs);
+    for (const QFileInfo &input : inputs) {
+      pool.start(new Task([&process, input]() { process(input); }));
+    }
+    pool.waitForDone();
+  }
+
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,236 @@
+#include "cpuvoronoidiagram.h"
+#include "densityfield.h"
+#include "parallel.h"
+#include "sitegrid.h"
+#include "stopwatch.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace {
+// edge length of the tiles the fused path caches moments for
+const int32_t tileSize = 64;
+
+uint64_t positionKey(const QVector2D& p) {
+  const float x = p.x();
+  const float y = p.y();
+  uint32_t bx, by;
+  std::memcpy(&bx, &x, sizeof(bx));
+  std::memcpy(&by, &y, sizeof(by));
+  return (uint64_t(bx) << 32) | by;
+}
+}  // namespace
+
+CPUVoronoiDiagram::CPUVoronoiDiagram(const DensityField& density) {
+  reset(density);
+}
+
+void CPUVoronoiDiagram::reset(const DensityField& density) {
+  m_width = density.width();
+  m_height = density.height();
+  m_tilesX = (m_width + tileSize - 1) / tileSize;
+  m_tilesY = (m_height + tileSize - 1) / tileSize;
+  // the cached moments belong to the previous density
+  m_tiles.assign(m_tilesX * m_tilesY, Tile{});
+  m_cachedPoints.clear();
+  m_cacheValid = false;
+}
+
+IndexMap CPUVoronoiDiagram::calculate(const QVector<QVector2D>& points) {
+  assert(!points.empty());
+
+  Stopwatch stopwatch;
+  SiteGrid grid(points, m_width, m_height);
+  IndexMap idxMap(m_width, m_height, points.size());
+  uint32_t* data = idxMap.scanLine(0);
+
+  parallelFor(m_height, [&](int, int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      uint32_t* row = data + y * m_width;
+      for (int x = 0; x < m_width; ++x) {
+        row[x] = grid.nearest(x, y);
+      }
+    }
+  });
+
+  m_stats = Stats{};
+  m_stats.raster = stopwatch.elapsed();
+  m_stats.pixels = size_t(m_width) * m_height;
+  return idxMap;
+}
+
+std::vector<VoronoiCell> CPUVoronoiDiagram::calculateCells(
+    const QVector<QVector2D>& points, const DensityField& density) {
+  assert(!points.empty());
+  assert(density.width() == m_width && density.height() == m_height);
+
+  Stopwatch stopwatch;
+  SiteGrid grid(points, m_width, m_height);
+
+  std::vector<char> dirty = findDirtyTiles(points);
+  std::vector<int32_t> dirtyTiles;
+  for (int32_t t = 0; t < static_cast<int32_t>(dirty.size()); ++t) {
+    if (dirty[t]) dirtyTiles.push_back(t);
+  }
+
+  parallelFor(dirtyTiles.size(), [&](int, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      computeTile(dirtyTiles[i], grid, density);
+    }
+  });
+
+  m_stats = Stats{};
+  m_stats.raster = stopwatch.restart();
+  for (int32_t t : dirtyTiles) {
+    const int32_t x0 = (t % m_tilesX) * tileSize;
+    const int32_t y0 = (t / m_tilesX) * tileSize;
+    m_stats.pixels += size_t(std::min(tileSize, m_width - x0)) *
+                      std::min(tileSize, m_height - y0);
+  }
+
+  // Reduce in tile order, so cached and recomputed tiles sum up exactly the
+  // same way.
+  std::vector<Moments> moments(points.size(), Moments{});
+  for (const Tile& tile : m_tiles) {
+    for (size_t i = 0; i < tile.owners.size(); ++i) {
+      moments[tile.owners[i]] += tile.moments[i];
+    }
+  }
+
+  std::vector<VoronoiCell> cells(points.size());
+  parallelFor(points.size(), [&](int, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      cells[i] = cellFromMoments(moments[i], m_width, m_height);
+    }
+  });
+
+  m_cachedPoints = points;
+  m_cacheValid = true;
+  m_stats.accumulate = stopwatch.elapsed();
+  return cells;
+}
+
+size_t CPUVoronoiDiagram::bytes() const {
+  size_t bytes = m_tiles.capacity() * sizeof(Tile) +
+                 m_cachedPoints.capacity() * sizeof(QVector2D);
+  for (const Tile& tile : m_tiles) {
+    bytes += tile.owners.capacity() * sizeof(uint32_t) +
+             tile.moments.capacity() * sizeof(Moments);
+  }
+  return bytes;
+}
+
+// A pixel keeps its site if that site still exists and no new site is at
+// most as far away. So a tile is clean if all its owners survive and no added
+// site lies within the tile's reach. Sites are matched by position, and
+// surviving sites must keep their relative order for ties to resolve the
+// same way. Owners of clean tiles are renumbered to the new indices.
+
+std::vector<char> CPUVoronoiDiagram::findDirtyTiles(
+    const QVector<QVector2D>& points) {
+  std::vector<char> dirty(m_tiles.size(), 1);
+  if (!m_cacheValid) return dirty;
+
+  std::unordered_map<uint64_t, uint32_t> newIndex;
+  newIndex.reserve(points.size());
+  for (int i = 0; i < points.size(); ++i) {
+    if (!newIndex.emplace(positionKey(points[i]), i).second) return dirty;
+  }
+
+  std::vector<int64_t> remap(m_cachedPoints.size(), -1);
+  std::vector<char> added(points.size(), 1);
+  int64_t last = -1;
+  for (int i = 0; i < m_cachedPoints.size(); ++i) {
+    auto it = newIndex.find(positionKey(m_cachedPoints[i]));
+    if (it == newIndex.end()) continue;
+    if (it->second <= last || !added[it->second]) return dirty;
+    remap[i] = last = it->second;
+    added[it->second] = 0;
+  }
+
+  float maxReach = 0.0f;
+  for (size_t t = 0; t < m_tiles.size(); ++t) {
+    const Tile& tile = m_tiles[t];
+    dirty[t] = std::any_of(tile.owners.begin(), tile.owners.end(),
+                           [&](uint32_t owner) { return remap[owner] < 0; });
+    maxReach = std::max(maxReach, tile.reach);
+  }
+
+  const float reachRadius = std::sqrt(maxReach) + 1.0f;
+  for (int i = 0; i < points.size(); ++i) {
+    if (!added[i]) continue;
+    const float sx = points[i].x() * m_width;
+    const float sy = points[i].y() * m_height;
+
+    const int32_t tx0 = std::max(0, int32_t((sx - reachRadius) / tileSize));
+    const int32_t ty0 = std::max(0, int32_t((sy - reachRadius) / tileSize));
+    const int32_t tx1 =
+        std::min(m_tilesX - 1, int32_t((sx + reachRadius) / tileSize));
+    const int32_t ty1 =
+        std::min(m_tilesY - 1, int32_t((sy + reachRadius) / tileSize));
+
+    for (int32_t ty = ty0; ty <= ty1; ++ty) {
+      for (int32_t tx = tx0; tx <= tx1; ++tx) {
+        const int32_t t = ty * m_tilesX + tx;
+        if (dirty[t]) continue;
+
+        // distance to the nearest pixel center of the tile
+        const float x0 = tx * tileSize + 0.5f;
+        const float y0 = ty * tileSize + 0.5f;
+        const float x1 = std::min((tx + 1) * tileSize, m_width) - 0.5f;
+        const float y1 = std::min((ty + 1) * tileSize, m_height) - 0.5f;
+        const float dx = std::max({0.0f, x0 - sx, sx - x1});
+        const float dy = std::max({0.0f, y0 - sy, sy - y1});
+
+        // generous tolerance, a false positive only costs time
+        const float reach = m_tiles[t].reach;
+        dirty[t] = dx * dx + dy * dy <= reach * 1.0001f + 0.01f;
+      }
+    }
+  }
+
+  for (size_t t = 0; t < m_tiles.size(); ++t) {
+    if (dirty[t]) continue;
+    for (uint32_t& owner : m_tiles[t].owners) owner = remap[owner];
+  }
+  return dirty;
+}
+
+void CPUVoronoiDiagram::computeTile(int32_t t, const SiteGrid& grid,
+                                    const DensityField& density) {
+  Tile& tile = m_tiles[t];
+  tile.owners.clear();
+  tile.moments.clear();
+  tile.reach = 0.0f;
+
+  const int32_t x0 = (t % m_tilesX) * tileSize;
+  const int32_t y0 = (t / m_tilesX) * tileSize;
+  const int32_t x1 = std::min(x0 + tileSize, m_width);
+  const int32_t y1 = std::min(y0 + tileSize, m_height);
+
+  uint32_t row[tileSize];
+  for (int32_t y = y0; y < y1; ++y) {
+    for (int32_t x = x0; x < x1; ++x) {
+      float distance2;
+      row[x - x0] = grid.nearest(x, y, distance2);
+      tile.reach = std::max(tile.reach, distance2);
+    }
+
+    forEachSpan(row, x1 - x0, [&](int32_t begin, int32_t end, uint32_t index) {
+      // the owners of a tile are few, search from the most recent one
+      auto it = std::find(tile.owners.rbegin(), tile.owners.rend(), index);
+      size_t slot;
+      if (it == tile.owners.rend()) {
+        slot = tile.owners.size();
+        tile.owners.push_back(index);
+        tile.moments.push_back(Moments{});
+      } else {
+        slot = tile.owners.size() - 1 - (it - tile.owners.rbegin());
+      }
+      tile.moments[slot].addSpan(density, y, x0 + begin, x0 + end);
+    });
+  }
+}
@@ -0,0 +1,53 @@
+#ifndef CPUVORONOIDIAGRAM_H
+#define CPUVORONOIDIAGRAM_H
+
+#include "voronoidiagram.h"
+
+#include <vector>
+
+class SiteGrid;
+
+// Software backend for machines without a GPU. Sites are bucketed into a
+// uniform grid and every pixel searches the grid in growing rings around its
+// own bucket for the nearest site. Rows are distributed over all cores.
+class CPUVoronoiDiagram : public VoronoiDiagram {
+ public:
+  CPUVoronoiDiagram(const DensityField& density);
+
+  IndexMap calculate(const QVector<QVector2D>& points) override;
+
+  void reset(const DensityField& density) override;
+
+  // Fused variant that assigns and accumulates the image tile by tile. The
+  // moments of every tile are cached, and on the next call only the tiles
+  // that can be affected by added, moved or removed sites are recomputed.
+  // The result is identical to recomputing all tiles.
+  std::vector<VoronoiCell> calculateCells(
+      const QVector<QVector2D>& points, const DensityField& density) override;
+
+  size_t bytes() const override;
+
+ private:
+  struct Tile {
+    // sites owning pixels of the tile and their partial moments
+    std::vector<uint32_t> owners;
+    std::vector<Moments> moments;
+    // largest squared distance of a tile pixel to its site
+    float reach;
+  };
+
+  int32_t m_width;
+  int32_t m_height;
+  int32_t m_tilesX;
+  int32_t m_tilesY;
+
+  std::vector<Tile> m_tiles;
+  QVector<QVector2D> m_cachedPoints;
+  bool m_cacheValid;
+
+  std::vector<char> findDirtyTiles(const QVector<QVector2D>& points);
+  void computeTile(int32_t tile, const SiteGrid& grid,
+                   const DensityField& density);
+};
+
+#endif  // CPUVORONOIDIAGRAM_H
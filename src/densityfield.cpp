@@ -0,0 +1,195 @@
+#include "densityfield.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+
+// Every pixel carries this much density on top of (255 - gray) / 255, which
+// keeps white regions from having zero weight.
+static const double densityEpsilon = std::numeric_limits<float>::epsilon();
+
+namespace {
+// Gray values of a view averaged over 2x2 blocks.
+std::vector<uchar> halve(const GrayView& gray, GrayView& half) {
+  half.width = std::max(1, gray.width / 2);
+  half.height = std::max(1, gray.height / 2);
+  half.stride = half.width;
+
+  std::vector<uchar> data(half.width * half.height);
+  parallelFor(half.height, [&](int, int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      const int32_t y0 = std::min(2 * y, gray.height - 1);
+      const int32_t y1 = std::min(2 * y + 1, gray.height - 1);
+      const uchar* r0 = gray.constScanLine(y0);
+      const uchar* r1 = gray.constScanLine(y1);
+      for (int32_t x = 0; x < half.width; ++x) {
+        const int32_t x0 = std::min(2 * x, gray.width - 1);
+        const int32_t x1 = std::min(2 * x + 1, gray.width - 1);
+        data[y * half.width + x] = (r0[x0] + r0[x1] + r1[x0] + r1[x1] + 2) / 4;
+      }
+    }
+  });
+  half.data = data.data();
+  return data;
+}
+
+// Source pixels and weight of the second one for bilinear sampling at the
+// pixel centers of a resized axis.
+struct Taps {
+  std::vector<int32_t> first;
+  std::vector<int32_t> second;
+  std::vector<float> weight;
+
+  Taps(int32_t source, int32_t target)
+      : first(target), second(target), weight(target) {
+    const float scale = float(source) / target;
+    for (int32_t i = 0; i < target; ++i) {
+      const float s = std::max(0.0f, (i + 0.5f) * scale - 0.5f);
+      first[i] = std::min(static_cast<int32_t>(s), source - 1);
+      second[i] = std::min(first[i] + 1, source - 1);
+      weight[i] = s - first[i];
+    }
+  }
+};
+}  // namespace
+
+template <class Rows>
+void DensityField::build(Rows rows) {
+  const int32_t stride = m_width + 1;
+  m_prefix0 = QVector<uint16_t>(stride * m_height);
+  m_prefix1 = QVector<uint32_t>(stride * m_height);
+  m_prefix2 = QVector<uint32_t>(stride * m_height);
+  m_blockBase = QVector<BlockBase>(m_blocksPerRow * m_height);
+
+  uint16_t* prefix0 = m_prefix0.data();
+  uint32_t* prefix1 = m_prefix1.data();
+  uint32_t* prefix2 = m_prefix2.data();
+  BlockBase* blockBase = m_blockBase.data();
+
+  parallelFor(m_height, [&](int, int begin, int end) {
+    std::vector<uchar> buffer(m_width);
+    for (int y = begin; y < end; ++y) {
+      const uchar* row = rows(y, buffer.data());
+
+      uint16_t* p0 = prefix0 + y * stride;
+      uint32_t* p1 = prefix1 + y * stride;
+      uint32_t* p2 = prefix2 + y * stride;
+      BlockBase* base = blockBase + y * m_blocksPerRow;
+
+      BlockBase total = {0, 0, 0};
+      uint32_t s0 = 0, s1 = 0, s2 = 0;
+      for (int32_t x = 0; x <= m_width; ++x) {
+        const int32_t local = x % blockSize;
+        if (local == 0) {
+          // close the previous block and restart the local sums
+          if (x > 0) {
+            const uint64_t b = x - blockSize;
+            total.sum0 += s0;
+            total.sum1 += s1 + b * s0;
+            total.sum2 += s2 + 2 * b * s1 + b * b * s0;
+          }
+          base[x / blockSize] = total;
+          s0 = s1 = s2 = 0;
+        }
+        p0[x] = static_cast<uint16_t>(s0);
+        p1[x] = s1;
+        p2[x] = s2;
+        if (x == m_width) break;
+
+        const uint32_t v = 255 - row[x];
+        s0 += v;
+        s1 += local * v;
+        s2 += local * local * v;
+      }
+    }
+  });
+}
+
+DensityField::DensityField(const GrayView& gray)
+    : m_width(gray.width),
+      m_height(gray.height),
+      m_blocksPerRow(gray.width / blockSize + 1) {
+  build([&gray](int32_t y, uchar*) { return gray.constScanLine(y); });
+}
+
+DensityField::DensityField(const GrayView& gray, int32_t width,
+                           int32_t height)
+    : m_width(width), m_height(height), m_blocksPerRow(width / blockSize + 1) {
+  if (gray.width == width && gray.height == height) {
+    build([&gray](int32_t y, uchar*) { return gray.constScanLine(y); });
+    return;
+  }
+
+  // bilinear filtering only sees 2x2 pixels, halve larger factors first
+  GrayView source = gray;
+  std::vector<uchar> halved;
+  while (source.width >= 2 * width && source.height >= 2 * height &&
+         (source.width > 2 * width || source.height > 2 * height)) {
+    GrayView half;
+    std::vector<uchar> data = halve(source, half);
+    halved.swap(data);
+    source = half;
+  }
+
+  const Taps tx(source.width, width);
+  const Taps ty(source.height, height);
+  build([&](int32_t y, uchar* buffer) -> const uchar* {
+    const uchar* r0 = source.constScanLine(ty.first[y]);
+    const uchar* r1 = source.constScanLine(ty.second[y]);
+    const float wy = ty.weight[y];
+    for (int32_t x = 0; x < width; ++x) {
+      const float wx = tx.weight[x];
+      const float top = r0[tx.first[x]] * (1.0f - wx) + r0[tx.second[x]] * wx;
+      const float bottom =
+          r1[tx.first[x]] * (1.0f - wx) + r1[tx.second[x]] * wx;
+      buffer[x] = static_cast<uchar>(top * (1.0f - wy) + bottom * wy + 0.5f);
+    }
+    return buffer;
+  });
+}
+
+float DensityField::density(uchar gray) {
+  return static_cast<float>((255 - gray) / 255.0 + densityEpsilon);
+}
+
+DensityField::BlockBase DensityField::prefix(int32_t y, int32_t x) const {
+  const int32_t block = x / blockSize;
+  const uint64_t b = block * blockSize;
+  const int32_t i = y * (m_width + 1) + x;
+  const uint64_t p0 = m_prefix0[i];
+  const uint64_t p1 = m_prefix1[i];
+  const uint64_t p2 = m_prefix2[i];
+
+  const BlockBase& base = m_blockBase[y * m_blocksPerRow + block];
+  return {base.sum0 + p0, base.sum1 + p1 + b * p0,
+          base.sum2 + p2 + 2 * b * p1 + b * b * p0};
+}
+
+uchar DensityField::gray(int32_t x, int32_t y) const {
+  return static_cast<uchar>(255 - (prefix(y, x + 1).sum0 - prefix(y, x).sum0));
+}
+
+DensityField::SpanSums DensityField::rowSums(int32_t y, int32_t begin,
+                                             int32_t end) const {
+  const BlockBase a = prefix(y, begin);
+  const BlockBase b = prefix(y, end);
+
+  // closed forms of the sums of 1, x and x^2 over [begin, end)
+  auto squares = [](double k) { return (k - 1.0) * k * (2.0 * k - 1.0) / 6.0; };
+  const double n = end - begin;
+  const double x1 = (begin + end - 1.0) * n / 2.0;
+  const double x2 = squares(end) - squares(begin);
+
+  return {(b.sum0 - a.sum0) / 255.0 + densityEpsilon * n,
+          (b.sum1 - a.sum1) / 255.0 + densityEpsilon * x1,
+          (b.sum2 - a.sum2) / 255.0 + densityEpsilon * x2};
+}
+
+size_t DensityField::bytes() const {
+  return m_prefix0.capacity() * sizeof(uint16_t) +
+         m_prefix1.capacity() * sizeof(uint32_t) +
+         m_prefix2.capacity() * sizeof(uint32_t) +
+         m_blockBase.capacity() * sizeof(BlockBase);
+}
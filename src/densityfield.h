@@ -0,0 +1,86 @@
+#ifndef DENSITYFIELD_H
+#define DENSITYFIELD_H
+
+#include <QSize>
+#include <QVector>
+
+#include <cstddef>
+
+// Caller-owned 8 bit grayscale pixels, rows are stride bytes apart.
+struct GrayView {
+  const uchar* data;
+  int32_t width;
+  int32_t height;
+  int32_t stride;
+
+  const uchar* constScanLine(int32_t y) const {
+    return data + std::ptrdiff_t(y) * stride;
+  }
+};
+
+// Stippling density derived once per run from a grayscale image, where black
+// maps to one and white to a small positive epsilon. Only per-row prefix sums
+// of the density and its x and x^2 weighted versions are kept, so that the
+// moments of any run of pixels in a row can be looked up in constant time.
+class DensityField {
+ public:
+  // Sums of d, x * d and x^2 * d over a run of pixels.
+  struct SpanSums {
+    double sum0;
+    double sum1;
+    double sum2;
+  };
+
+  // Reads the gray values straight from the view.
+  explicit DensityField(const GrayView& gray);
+  // Resamples the view to the given size, bilinearly when enlarging and by
+  // repeated halving plus bilinear filtering when shrinking.
+  DensityField(const GrayView& gray, int32_t width, int32_t height);
+
+  int32_t width() const { return m_width; }
+  int32_t height() const { return m_height; }
+  QSize size() const { return QSize(m_width, m_height); }
+
+  static float density(uchar gray);
+
+  SpanSums rowSums(int32_t y, int32_t begin, int32_t end) const;
+
+  // Gray value of a single pixel.
+  uchar gray(int32_t x, int32_t y) const;
+
+  // Memory held by the prefix sums.
+  size_t bytes() const;
+
+ private:
+  // Prefix sums restart every block of this many pixels, which keeps them
+  // small enough for 16 and 32 bit integers.
+  static const int32_t blockSize = 256;
+
+  struct BlockBase {
+    uint64_t sum0;
+    uint64_t sum1;
+    uint64_t sum2;
+  };
+
+  int32_t m_width;
+  int32_t m_height;
+  int32_t m_blocksPerRow;
+
+  // Sums of v, x' * v and x'^2 * v with v = 255 - gray and x' the position
+  // within the block, exclusive of the pixel itself. One entry per pixel plus
+  // one at the end of each row.
+  QVector<uint16_t> m_prefix0;
+  QVector<uint32_t> m_prefix1;
+  QVector<uint32_t> m_prefix2;
+  // sums of all blocks before, in row coordinates
+  QVector<BlockBase> m_blockBase;
+
+  BlockBase prefix(int32_t y, int32_t x) const;
+
+  // Builds the prefix sums from rows(y, buffer), which returns the gray
+  // values of row y, either its own or written to the buffer of width bytes.
+  template <class Rows>
+  void build(Rows rows);
+};
+
+#endif  // DENSITYFIELD_H
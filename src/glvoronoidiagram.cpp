@@ -0,0 +1,464 @@
+#include "glvoronoidiagram.h"
+#include "densityfield.h"
+#include "parallel.h"
+#include "sitegrid.h"
+#include "stopwatch.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+
+#include <QCoreApplication>
+#include <QOpenGLBuffer>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QThread>
+
+#include "shader/Voronoi.frag.h"
+#include "shader/Voronoi.vert.h"
+
+////////////////////////////////////////////////////////////////////////////////
+/// OpenGL Voronoi Diagram
+
+namespace {
+// neighbor whose distance bounds the cone of a site
+const int32_t coneNeighbors = 6;
+// smallest cone radius in pixels
+const float minConeRadius = 4.0f;
+// clipped cones are doubled this many times before they cover everything
+const int maxFallbackRounds = 4;
+// set by the fragment shader if the cell may be clipped by its cone
+const uint32_t rimFlag = 0x80000000;
+// clear value of pixels not covered by any cone
+const uint32_t emptyIndex = 0xffffffff;
+// initial number of instances the site buffers can hold
+const int initialInstanceCapacity = 1024;
+
+void writeBuffer(QOpenGLBuffer& buffer, const void* data, int bytes) {
+  buffer.bind();
+  void* target = buffer.mapRange(
+      0, bytes,
+      QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidateBuffer);
+  std::memcpy(target, data, bytes);
+  buffer.unmap();
+  buffer.release();
+}
+}  // namespace
+
+GLVoronoiContext::GLVoronoiContext()
+    : m_context(nullptr), m_program(nullptr) {
+  // Offscreen surfaces may be backed by a hidden window, which has to be
+  // created on the GUI thread. The context is created by the first thread
+  // that makes it current.
+  assert(QCoreApplication::instance() &&
+         QThread::currentThread() == QCoreApplication::instance()->thread());
+  m_format.setMajorVersion(3);
+  m_format.setMinorVersion(3);
+  m_format.setProfile(QSurfaceFormat::CoreProfile);
+  m_surface = new QOffscreenSurface();
+  m_surface->setFormat(m_format);
+  m_surface->create();
+}
+
+GLVoronoiContext::~GLVoronoiContext() {
+  if (m_context) {
+    // the program needs the context current to free its GL objects
+    m_context->makeCurrent(m_surface);
+    delete m_program;
+    m_context->doneCurrent();
+    delete m_context;
+  }
+
+  if (QThread::currentThread() == m_surface->thread()) {
+    delete m_surface;
+  } else {
+    m_surface->deleteLater();
+  }
+}
+
+QOpenGLFunctions_3_3_Core* GLVoronoiContext::makeCurrent() {
+  if (!m_context) {
+    m_context = new QOpenGLContext();
+    m_context->setFormat(m_format);
+    m_context->create();
+    m_context->makeCurrent(m_surface);
+
+    m_program = new QOpenGLShaderProgram();
+    m_program->addShaderFromSourceCode(QOpenGLShader::Vertex,
+                                       voronoiVertex.c_str());
+    m_program->addShaderFromSourceCode(QOpenGLShader::Fragment,
+                                       voronoiFragment.c_str());
+    m_program->link();
+  } else {
+    m_context->makeCurrent(m_surface);
+  }
+  return m_context->versionFunctions<QOpenGLFunctions_3_3_Core>();
+}
+
+void GLVoronoiContext::doneCurrent() { m_context->doneCurrent(); }
+
+GLVoronoiDiagram::GLVoronoiDiagram(const DensityField& density,
+                                   std::shared_ptr<GLVoronoiContext> context)
+    : m_shared(std::move(context)), m_size(density.size()) {
+  QOpenGLFunctions_3_3_Core* gl = m_shared->makeCurrent();
+  QOpenGLShaderProgram* program = m_shared->program();
+
+  m_vao = new QOpenGLVertexArrayObject();
+  m_vao->create();
+
+  // The site index is rendered straight into an integer attachment and read
+  // back into a pixel buffer object, which the index map then points into.
+  gl->glGenRenderbuffers(1, &m_indexBuffer);
+  gl->glGenRenderbuffers(1, &m_depthBuffer);
+  gl->glGenFramebuffers(1, &m_framebuffer);
+  gl->glGenBuffers(1, &m_pixelBuffer);
+  m_pixelBufferMapped = false;
+
+  m_coneBuffer = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+  m_coneBuffer.create();
+  m_coneBuffer.setUsagePattern(QOpenGLBuffer::StaticDraw);
+
+  allocate(gl);
+
+  m_vao->bind();
+
+  m_coneBuffer.bind();
+  program->enableAttributeArray(0);
+  program->setAttributeBuffer(0, GL_FLOAT, 0, 3);
+  m_coneBuffer.release();
+
+  // per-site buffers, kept across calls and only grown when needed
+  m_instanceCapacity = initialInstanceCapacity;
+
+  m_positionBuffer = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+  m_positionBuffer.create();
+  m_positionBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+  m_positionBuffer.bind();
+  m_positionBuffer.allocate(m_instanceCapacity * sizeof(QVector2D));
+  program->enableAttributeArray(1);
+  program->setAttributeBuffer(1, GL_FLOAT, 0, 2);
+  gl->glVertexAttribDivisor(1, 1);
+  m_positionBuffer.release();
+
+  m_radiusBuffer = QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+  m_radiusBuffer.create();
+  m_radiusBuffer.setUsagePattern(QOpenGLBuffer::DynamicDraw);
+  m_radiusBuffer.bind();
+  m_radiusBuffer.allocate(m_instanceCapacity * sizeof(float));
+  program->enableAttributeArray(2);
+  program->setAttributeBuffer(2, GL_FLOAT, 0, 1);
+  gl->glVertexAttribDivisor(2, 1);
+  m_radiusBuffer.release();
+
+  m_vao->release();
+
+  m_shared->doneCurrent();
+}
+
+GLVoronoiDiagram::~GLVoronoiDiagram() {
+  QOpenGLFunctions_3_3_Core* gl = m_shared->makeCurrent();
+
+  unmapPixelBuffer(gl);
+  m_coneBuffer.destroy();
+  m_positionBuffer.destroy();
+  m_radiusBuffer.destroy();
+  gl->glDeleteBuffers(1, &m_pixelBuffer);
+  gl->glDeleteFramebuffers(1, &m_framebuffer);
+  gl->glDeleteRenderbuffers(1, &m_depthBuffer);
+  gl->glDeleteRenderbuffers(1, &m_indexBuffer);
+  m_vao->destroy();
+  delete m_vao;
+
+  m_shared->doneCurrent();
+}
+
+void GLVoronoiDiagram::reset(const DensityField& density) {
+  if (density.size() == m_size) return;
+  m_size = density.size();
+
+  QOpenGLFunctions_3_3_Core* gl = m_shared->makeCurrent();
+  unmapPixelBuffer(gl);
+  allocate(gl);
+  m_shared->doneCurrent();
+}
+
+// (Re)specifies the storage of all size dependent objects. The names stay the
+// same, so the framebuffer attachments and the VAO remain valid.
+
+void GLVoronoiDiagram::allocate(QOpenGLFunctions_3_3_Core* gl) {
+  const int width = m_size.width();
+  const int height = m_size.height();
+
+  gl->glBindRenderbuffer(GL_RENDERBUFFER, m_indexBuffer);
+  gl->glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, width, height);
+  gl->glBindRenderbuffer(GL_RENDERBUFFER, m_depthBuffer);
+  gl->glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width,
+                            height);
+  gl->glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+  gl->glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+  gl->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                GL_RENDERBUFFER, m_indexBuffer);
+  gl->glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                GL_RENDERBUFFER, m_depthBuffer);
+  assert(gl->glCheckFramebufferStatus(GL_FRAMEBUFFER) ==
+         GL_FRAMEBUFFER_COMPLETE);
+  gl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffer);
+  gl->glBufferData(GL_PIXEL_PACK_BUFFER, width * height * sizeof(uint32_t),
+                   nullptr, GL_STREAM_READ);
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  const QVector<QVector3D> cones = createConeDrawingData(m_size);
+  m_coneBuffer.bind();
+  m_coneBuffer.allocate(cones.constData(), cones.size() * sizeof(QVector3D));
+  m_coneBuffer.release();
+}
+
+void GLVoronoiDiagram::unmapPixelBuffer(QOpenGLFunctions_3_3_Core* gl) {
+  if (!m_pixelBufferMapped) return;
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffer);
+  gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  m_pixelBufferMapped = false;
+}
+
+// Fallback for a pixel buffer that cannot be mapped, e.g. when out of
+// memory. If the indices cannot be read at all, every pixel is assigned to
+// the first site, which is wrong but safe to accumulate.
+const uint32_t* GLVoronoiDiagram::readIndicesToHost(
+    QOpenGLFunctions_3_3_Core* gl) {
+  qWarning("Mapping the Voronoi pixel buffer failed, reading it directly.");
+  const int width = m_size.width();
+  const int height = m_size.height();
+  m_hostIndices.fill(0, width * height);
+
+  // clears the error of the failed mapping
+  gl->glGetError();
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  gl->glReadPixels(0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                   m_hostIndices.data());
+  if (gl->glGetError() != GL_NO_ERROR) {
+    qWarning("Reading the Voronoi diagram failed.");
+    m_hostIndices.fill(0);
+  }
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffer);
+  return m_hostIndices.constData();
+}
+
+void GLVoronoiDiagram::reserveInstances(int count) {
+  if (count <= m_instanceCapacity) return;
+  m_instanceCapacity = std::max(count, 2 * m_instanceCapacity);
+
+  // reallocating keeps the buffer names, so the VAO stays valid
+  m_positionBuffer.bind();
+  m_positionBuffer.allocate(m_instanceCapacity * sizeof(QVector2D));
+  m_positionBuffer.release();
+
+  m_radiusBuffer.bind();
+  m_radiusBuffer.allocate(m_instanceCapacity * sizeof(float));
+  m_radiusBuffer.release();
+}
+
+IndexMap GLVoronoiDiagram::calculate(const QVector<QVector2D>& points) {
+  assert(!points.empty());
+  assert(static_cast<uint32_t>(points.size()) < rimFlag);
+
+  m_stats = Stats{};
+  Stopwatch stopwatch;
+
+  updateConeRadii(points);
+
+  QOpenGLFunctions_3_3_Core* gl = m_shared->makeCurrent();
+  QOpenGLShaderProgram* program = m_shared->program();
+
+  // the previous index map is invalidated here
+  unmapPixelBuffer(gl);
+
+  m_vao->bind();
+
+  program->bind();
+  program->setUniformValue("maxRadius", m_maxRadius);
+  program->setUniformValue("pixelSize", 1.0f / m_size.width());
+
+  reserveInstances(points.size());
+  writeBuffer(m_positionBuffer, points.constData(),
+              points.size() * sizeof(QVector2D));
+  writeBuffer(m_radiusBuffer, m_radii.constData(),
+              m_radii.size() * sizeof(float));
+
+  const int width = m_size.width();
+  const int height = m_size.height();
+
+  gl->glBindFramebuffer(GL_FRAMEBUFFER, m_framebuffer);
+
+  gl->glViewport(0, 0, width, height);
+
+  gl->glDisable(GL_MULTISAMPLE);
+  gl->glDisable(GL_DITHER);
+
+  gl->glEnable(GL_DEPTH_TEST);
+
+  gl->glReadBuffer(GL_COLOR_ATTACHMENT0);
+  gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffer);
+
+  const GLuint clearIndex[] = {emptyIndex, 0, 0, 0};
+  const GLfloat clearDepth = 1.0f;
+
+  const uint32_t* indices = nullptr;
+  m_clipped.resize(points.size());
+
+  for (int round = 0;; ++round) {
+    gl->glClearBufferuiv(GL_COLOR, 0, clearIndex);
+    gl->glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+
+    gl->glDrawArraysInstanced(GL_TRIANGLE_FAN, 0, m_coneVertices,
+                              points.size());
+    // The copy into the pixel buffer is queued right behind the draw, the
+    // fences only separate the two in the stats. The indices are needed
+    // right away, so the CPU still waits for the copy.
+    GLsync drawn = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glReadPixels(0, 0, width, height, GL_RED_INTEGER, GL_UNSIGNED_INT,
+                     nullptr);
+    GLsync read = gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl->glFlush();
+    gl->glClientWaitSync(drawn, 0, GL_TIMEOUT_IGNORED);
+    m_stats.raster += stopwatch.restart();
+    m_stats.pixels += size_t(width) * height;
+
+    gl->glClientWaitSync(read, 0, GL_TIMEOUT_IGNORED);
+    gl->glDeleteSync(drawn);
+    gl->glDeleteSync(read);
+    indices = static_cast<const uint32_t*>(
+        gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                             width * height * sizeof(uint32_t),
+                             GL_MAP_READ_BIT));
+    m_pixelBufferMapped = indices != nullptr;
+    if (!indices) indices = readIndicesToHost(gl);
+
+    // Scanning for flagged pixels is cheap compared to the old decode. Only
+    // if there are any, the clipped cells are collected in a second pass.
+    QVector<uint32_t> chunkFlags(parallelChunks(height), 0);
+    parallelFor(height, [&](int chunk, int begin, int end) {
+      uint32_t flags = 0;
+      const uint32_t* row = indices + begin * width;
+      const uint32_t* rowEnd = indices + end * width;
+      for (; row != rowEnd; ++row) flags |= *row;
+      chunkFlags[chunk] = flags & rimFlag;
+    });
+    m_stats.readback += stopwatch.restart();
+
+    if (std::all_of(chunkFlags.begin(), chunkFlags.end(),
+                    [](uint32_t flags) { return flags == 0; })) {
+      break;
+    }
+
+    bool uncovered = false;
+    std::fill(m_clipped.begin(), m_clipped.end(), false);
+    for (int i = 0; i < width * height; ++i) {
+      if (indices[i] == emptyIndex) {
+        uncovered = true;
+      } else if (indices[i] & rimFlag) {
+        m_clipped[indices[i] & ~rimFlag] = true;
+      }
+    }
+
+    unmapPixelBuffer(gl);
+    gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, m_pixelBuffer);
+
+    // Grow the cones that reached their rim and draw again. The index map
+    // is only exact once no cell touches the rim of its cone.
+    const bool lastRound = round + 1 >= maxFallbackRounds;
+    for (int i = 0; i < m_radii.size(); ++i) {
+      if (uncovered || (lastRound && m_clipped[i])) {
+        m_radii[i] = m_maxRadius;
+      } else if (m_clipped[i]) {
+        m_radii[i] = std::min(2.0f * m_radii[i], m_maxRadius);
+      }
+    }
+    writeBuffer(m_radiusBuffer, m_radii.constData(),
+                m_radii.size() * sizeof(float));
+  }
+
+  gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  gl->glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+  program->release();
+
+  m_vao->release();
+
+  m_shared->doneCurrent();
+  m_stats.raster += stopwatch.elapsed();
+
+  // stays mapped until the next call
+  return IndexMap(width, height, points.size(), indices);
+}
+
+size_t GLVoronoiDiagram::bytes() const {
+  // index and depth attachments plus the pixel buffer
+  const size_t frame = size_t(m_size.width()) * m_size.height();
+  return 3 * frame * sizeof(uint32_t) +
+         m_coneVertices * sizeof(QVector3D) +
+         m_instanceCapacity * (sizeof(QVector2D) + sizeof(float)) +
+         m_radii.capacity() * sizeof(float) +
+         m_clipped.capacity() * sizeof(bool) +
+         m_hostIndices.capacity() * sizeof(uint32_t);
+}
+
+// Estimates an upper bound for the extent of every cell from the distance to
+// its k-th nearest neighbor. Cells that turn out larger are caught by the rim
+// test in calculate().
+
+void GLVoronoiDiagram::updateConeRadii(const QVector<QVector2D>& points) {
+  const int32_t width = m_size.width();
+  SiteGrid grid(points, width, m_size.height());
+
+  m_radii.resize(points.size());
+  float* radii = m_radii.data();
+  parallelFor(points.size(), [&](int, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const float distance = grid.neighborDistance(i, coneNeighbors);
+      const float radius = std::max(distance, minConeRadius) / width;
+      radii[i] = std::min(radius, m_maxRadius);
+    }
+  });
+}
+
+// Calculate the number of slices required to ensure the given max. meshing
+// error. See "Fast Computation of Generalized Voronoi Diagram Using Graphics
+// Hardware", Hoff et. al., Proc. of SIGGRAPH 99.
+
+uint calcNumConeSlices(const float radius, const float maxError) {
+  const float alpha = 2.0f * std::acos((radius - maxError) / radius);
+  return static_cast<uint>(2 * M_PIf32 / alpha + 0.5f);
+}
+
+QVector<QVector3D> GLVoronoiDiagram::createConeDrawingData(const QSize& size) {
+  const float aspect = static_cast<float>(size.width()) / size.height();
+
+  // A cone of this radius covers the whole frame from any site, with some
+  // slack for the meshing error of the rim.
+  m_maxRadius =
+      std::sqrt(1.0f + 1.0f / (aspect * aspect)) + 2.0f / size.width();
+
+  const float maxError =
+      1.0f / (size.width() > size.height() ? size.width() : size.height());
+  const uint numConeSlices = calcNumConeSlices(m_maxRadius, maxError);
+
+  const float angleIncr = 2.0f * M_PIf32 / numConeSlices;
+
+  // unit cone, the z coordinate is the distance to the apex
+  QVector<QVector3D> conePoints;
+  conePoints.push_back(QVector3D(0.0f, 0.0f, 0.0f));
+
+  for (uint i = 0; i < numConeSlices; ++i) {
+    conePoints.push_back(QVector3D(std::cos(i * angleIncr),
+                                   aspect * std::sin(i * angleIncr), 1.0f));
+  }
+
+  conePoints.push_back(QVector3D(1.0f, 0.0f, 1.0f));
+
+  m_coneVertices = conePoints.size();
+  return conePoints;
+}
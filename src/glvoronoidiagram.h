@@ -0,0 +1,94 @@
+#ifndef GLVORONOIDIAGRAM_H
+#define GLVORONOIDIAGRAM_H
+
+#include "voronoidiagram.h"
+
+#include <QOffscreenSurface>
+#include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <QOpenGLShaderProgram>
+#include <QOpenGLVertexArrayObject>
+
+class QOpenGLFunctions_3_3_Core;
+
+// Context, offscreen surface and shader program of the OpenGL backend. None
+// of them depend on the frame size, so a pool shares them between all of its
+// diagrams. The surface is created with the context object, which has to
+// happen on the GUI thread. The context and the program are created by the
+// first thread that makes it current, only that thread may use and destroy
+// it afterwards.
+class GLVoronoiContext {
+ public:
+  GLVoronoiContext();
+  ~GLVoronoiContext();
+
+  GLVoronoiContext(const GLVoronoiContext&) = delete;
+  GLVoronoiContext& operator=(const GLVoronoiContext&) = delete;
+
+  QOpenGLFunctions_3_3_Core* makeCurrent();
+  void doneCurrent();
+
+  // null until the context is first made current
+  QOpenGLContext* context() const { return m_context; }
+  QOpenGLShaderProgram* program() const { return m_program; }
+
+ private:
+  QSurfaceFormat m_format;
+  QOpenGLContext* m_context;
+  QOffscreenSurface* m_surface;
+  QOpenGLShaderProgram* m_program;
+};
+
+// Renders one depth-tested cone per site into an offscreen framebuffer, see
+// "Fast Computation of Generalized Voronoi Diagram Using Graphics Hardware",
+// Hoff et. al., Proc. of SIGGRAPH 99. Each cone only reaches as far as its
+// cell is expected to extend, so the fill cost does not grow with the number
+// of sites times the frame size.
+//
+// The returned index map points into mapped GPU memory and is only valid
+// until the next call to calculate() or reset(), or the destruction of the
+// diagram.
+class GLVoronoiDiagram : public VoronoiDiagram {
+ public:
+  GLVoronoiDiagram(const DensityField& density,
+                   std::shared_ptr<GLVoronoiContext> context);
+  ~GLVoronoiDiagram() override;
+
+  IndexMap calculate(const QVector<QVector2D>& points) override;
+
+  // Keeps all GL objects, only their storage is resized.
+  void reset(const DensityField& density) override;
+
+  size_t bytes() const override;
+
+ private:
+  std::shared_ptr<GLVoronoiContext> m_shared;
+
+  int m_coneVertices;
+  float m_maxRadius;
+
+  QOpenGLVertexArrayObject* m_vao;
+  QOpenGLBuffer m_coneBuffer;
+  QOpenGLBuffer m_positionBuffer;
+  QOpenGLBuffer m_radiusBuffer;
+  int m_instanceCapacity;
+  GLuint m_framebuffer;
+  GLuint m_indexBuffer;
+  GLuint m_depthBuffer;
+  GLuint m_pixelBuffer;
+  bool m_pixelBufferMapped;
+  QSize m_size;
+  QVector<float> m_radii;
+  QVector<bool> m_clipped;
+  // indices read without the pixel buffer if it could not be mapped
+  QVector<uint32_t> m_hostIndices;
+
+  void allocate(QOpenGLFunctions_3_3_Core* gl);
+  QVector<QVector3D> createConeDrawingData(const QSize& size);
+  void unmapPixelBuffer(QOpenGLFunctions_3_3_Core* gl);
+  const uint32_t* readIndicesToHost(QOpenGLFunctions_3_3_Core* gl);
+  void reserveInstances(int count);
+  void updateConeRadii(const QVector<QVector2D>& points);
+};
+
+#endif  // GLVORONOIDIAGRAM_H
@@ -1,17 +1,20 @@
 #include "lbgstippling.h"
+#include "densityfield.h"
+#include "parallel.h"
+#include "stipplecache.h"
+#include "stopwatch.h"
 #include "voronoicell.h"
 
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <numeric>
 #include <random>
 
 #include <QVector>
 #include <QtMath>
 
-namespace Random {
-static std::random_device rd;
-static std::mt19937 gen(rd());
-}  // namespace Random
-
 using Params = LBGStippling::Params;
 using Status = LBGStippling::Status;
 
@@ -22,14 +25,23 @@ QVector<QVector2D> sites(const std::vector<Stipple> &stipples) {
   return sites;
 }
 
-std::vector<Stipple> randomStipples(size_t n, float size) {
+// Each run owns its engine. It is reseeded from the seed of the run for the
+// initial stipples and for every iteration, so that a resumed run continues
+// like an uninterrupted one.
+void reseed(std::mt19937 &random, uint32_t seed, uint32_t stream) {
+  std::seed_seq seq{seed, stream};
+  random.seed(seq);
+}
+
+const uint32_t initialStream = std::numeric_limits<uint32_t>::max();
+
+void randomStipples(size_t n, float size, std::mt19937 &random,
+                    std::vector<Stipple> &stipples) {
   std::uniform_real_distribution<float> dis(0.01f, 0.99f);
-  std::vector<Stipple> stipples(n);
+  stipples.resize(n);
   std::generate(stipples.begin(), stipples.end(), [&]() {
-    return Stipple{QVector2D(dis(Random::gen), dis(Random::gen)), size,
-                   Qt::black};
+    return Stipple{QVector2D(dis(random), dis(random)), size, Qt::black};
   });
-  return stipples;
 }
 
 template <class T>
@@ -37,27 +49,25 @@ inline T pow2(T x) {
   return x * x;
 }
 
-QVector2D jitter(QVector2D s) {
-  using namespace Random;
+QVector2D jitter(QVector2D s, std::mt19937 &random) {
   std::uniform_real_distribution<float> jitter_dis(-0.001f, 0.001f);
-  return s += QVector2D(jitter_dis(gen), jitter_dis(gen));
+  return s += QVector2D(jitter_dis(random), jitter_dis(random));
 }
 
-float getSplitValueUpper(float pointDiameter, float hysteresis,
-                         size_t superSampling) {
+// The scale is the number of density pixels per input pixel along an axis.
+float getSplitValueUpper(float pointDiameter, float hysteresis, float scale) {
   const float pointArea = M_PIf32 * pow2(pointDiameter / 2.0f);
-  return (1.0f + hysteresis / 2.0f) * pointArea * pow2(superSampling);
+  return (1.0f + hysteresis / 2.0f) * pointArea * pow2(scale);
 }
 
-float getSplitValueLower(float pointDiameter, float hysteresis,
-                         size_t superSampling) {
+float getSplitValueLower(float pointDiameter, float hysteresis, float scale) {
   const float pointArea = M_PIf32 * pow2(pointDiameter / 2.0f);
-  return (1.0f - hysteresis / 2.0f) * pointArea * pow2(superSampling);
+  return (1.0f - hysteresis / 2.0f) * pointArea * pow2(scale);
 }
 
-float stippleSize(const VoronoiCell &cell, const Params &params) {
+float stippleSize(float avgIntensity, const Params &params) {
   if (params.adaptivePointSize) {
-    const float avgIntensitySqrt = std::sqrt(cell.sumDensity / cell.area);
+    const float avgIntensitySqrt = std::sqrt(avgIntensity);
     return params.pointSizeMin * (1.0f - avgIntensitySqrt) +
            params.pointSizeMax * avgIntensitySqrt;
   } else {
@@ -65,16 +75,270 @@ float stippleSize(const VoronoiCell &cell, const Params &params) {
   }
 }
 
+float stippleSize(const VoronoiCell &cell, const Params &params) {
+  return stippleSize(cell.sumDensity / cell.area, params);
+}
+
+// Places about as many stipples as the density holds once converged. A
+// stipple's cell then holds the density between the split and merge values,
+// whose mean does not depend on the hysteresis. Every pixel counts as its
+// density over that of a cell of its own intensity, and the stipples are
+// spread over these weights in row-major order, one per stratum.
+void densityStipples(const DensityField &field, float scale,
+                     const Params &params, std::mt19937 &random,
+                     std::vector<Stipple> &stipples) {
+  const int32_t width = field.width();
+  const int32_t height = field.height();
+
+  // both only depend on the gray value of a pixel
+  float weights[256];
+  float sizes[256];
+  for (int gray = 0; gray < 256; ++gray) {
+    const float density = DensityField::density(static_cast<uchar>(gray));
+    const float diameter = stippleSize(density, params);
+    const float cellDensity =
+        0.5f * (getSplitValueLower(diameter, params.hysteresis, scale) +
+                getSplitValueUpper(diameter, params.hysteresis, scale));
+    weights[gray] = density / cellDensity;
+    sizes[gray] = diameter;
+  }
+
+  std::vector<double> rowTotals(height);
+  parallelFor(height, [&](int, int begin, int end) {
+    for (int32_t y = begin; y < end; ++y) {
+      double total = 0.0;
+      for (int32_t x = 0; x < width; ++x) total += weights[field.gray(x, y)];
+      rowTotals[y] = total;
+    }
+  });
+  const double total =
+      std::accumulate(rowTotals.begin(), rowTotals.end(), 0.0);
+  const size_t count =
+      std::max<size_t>({1, params.initialPoints, size_t(std::lround(total))});
+
+  std::uniform_real_distribution<float> dis(0.0f, 1.0f);
+  stipples.clear();
+  stipples.reserve(count);
+  const double stratum = total / count;
+  double next = dis(random) * stratum;
+  double rowStart = 0.0;
+  for (int32_t y = 0; y < height && stipples.size() < count; ++y) {
+    // rows without a stipple are skipped as a whole
+    if (next < rowStart + rowTotals[y]) {
+      double sum = rowStart;
+      for (int32_t x = 0; x < width && stipples.size() < count; ++x) {
+        const uchar gray = field.gray(x, y);
+        sum += weights[gray];
+        while (next < sum && stipples.size() < count) {
+          const QVector2D pos((x + dis(random)) / width,
+                              (y + dis(random)) / height);
+          stipples.push_back({pos, sizes[gray], Qt::black});
+          next = (stipples.size() + dis(random)) * stratum;
+        }
+      }
+    }
+    rowStart += rowTotals[y];
+  }
+  // rounding may leave the last stratum empty
+  while (stipples.size() < count) {
+    stipples.push_back({QVector2D(dis(random), dis(random)),
+                        params.initialPointSize, Qt::black});
+  }
+}
+
 float currentHysteresis(size_t i, const Params &params) {
   return params.hysteresis + i * params.hysteresisDelta;
 }
 
-bool notFinished(const Status &status, const Params &params) {
-  auto [iteration, size, splits, merges, hysteresis] = status;
-  return !((splits == 0 && merges == 0) || (iteration == params.maxIterations));
+bool notFinished(const Status &status, const Params &params,
+                 bool finestLevel) {
+  return !((finestLevel && status.splits == 0 && status.merges == 0) ||
+           (status.iteration >= params.maxIterations));
+}
+
+float residual(const QVector<QVector2D> &sites,
+               const std::vector<VoronoiCell> &cells, const GrayView &gray) {
+  double sum = 0.0;
+  size_t count = 0;
+  for (size_t i = 0; i < cells.size(); ++i) {
+    if (cells[i].area == 0.0f) continue;
+    const QVector2D d = cells[i].centroid - sites[i];
+    sum += std::hypot(d.x() * gray.width, d.y() * gray.height);
+    ++count;
+  }
+  return count > 0 ? static_cast<float>(sum / count) : 0.0f;
+}
+
+// Below this many density pixels per stipple a level is too coarse to place
+// the stipples any further.
+const float minPixelsPerStipple = 64.0f;
+
+// Halves the resolution until the requested number of levels is reached or
+// the image gets too small. The finest level comes first and is resampled by
+// the supersampling factor.
+std::vector<DensityField> densityPyramid(const GrayView &gray,
+                                         const Params &params) {
+  int32_t width = params.superSamplingFactor * gray.width;
+  int32_t height = params.superSamplingFactor * gray.height;
+
+  std::vector<DensityField> pyramid;
+  pyramid.emplace_back(gray, width, height);
+  while (pyramid.size() < params.pyramidLevels && width >= 128 &&
+         height >= 128) {
+    width /= 2;
+    height /= 2;
+    pyramid.emplace_back(gray, width, height);
+  }
+  return pyramid;
 }
 
-LBGStippling::LBGStippling() {
+// affordable is the number of iterations on the next level that fit into
+// the time budget.
+bool levelUp(const Status &status, const DensityField &field,
+             size_t levelsAbove, const Params &params, double affordable) {
+  const float changeRate =
+      float(status.splits + status.merges) / std::max<size_t>(1, status.size);
+  const float pixelsPerStipple = float(field.width()) * field.height() /
+                                 std::max<size_t>(1, status.size);
+  // leave at least one iteration for every level above
+  const size_t iterationsLeft = params.maxIterations - status.iteration - 1;
+  return changeRate < params.levelUpRate ||
+         pixelsPerStipple < minPixelsPerStipple ||
+         iterationsLeft <= levelsAbove || affordable - 1.0 <= levelsAbove;
+}
+
+// Plans the iterations of a run against its time budget. The time per
+// density pixel is averaged, so the estimate follows the pyramid levels.
+// Iterations get slower as the stipples multiply, so the last one is taken
+// if it was slower than the average.
+class TimeBudget {
+ public:
+  explicit TimeBudget(const Params &params) : m_params(params) {}
+
+  bool enabled() const { return m_params.timeBudgetMs > 0; }
+
+  void finished(double iterationMs, const DensityField &field) {
+    const double perPixel = iterationMs / pixels(field);
+    m_average = m_iterations == 0 ? perPixel
+                                  : (1.0 - averageWeight) * m_average +
+                                        averageWeight * perPixel;
+    m_last = perPixel;
+    ++m_iterations;
+  }
+
+  // Number of further iterations on the given level expected to fit into
+  // the budget.
+  double affordable(double elapsedMs, const DensityField &field) const {
+    if (!enabled() || m_iterations == 0) {
+      return std::numeric_limits<double>::infinity();
+    }
+    const double left = m_params.timeBudgetMs - elapsedMs;
+    return left / (std::max(m_average, m_last) * pixels(field));
+  }
+
+  // Raises the hysteresis by as many planned steps as needed to fit the
+  // remaining iterations into the budget, but by at least one.
+  float hysteresis(size_t iteration, float previous, double elapsedMs,
+                   const DensityField &field) const {
+    if (iteration == 0) return m_params.hysteresis;
+    const double planned = double(m_params.maxIterations) - iteration;
+    const double steps =
+        std::max(1.0, planned / std::max(1.0, affordable(elapsedMs, field)));
+    return previous + static_cast<float>(steps) * m_params.hysteresisDelta;
+  }
+
+ private:
+  static constexpr double averageWeight = 0.3;
+
+  const Params &m_params;
+  double m_average = 0.0;
+  double m_last = 0.0;
+  size_t m_iterations = 0;
+
+  static double pixels(const DensityField &field) {
+    return double(field.width()) * field.height();
+  }
+};
+
+// Keeps the slots of the stipples in a consumer's copy up to date. A kept
+// stipple and the first half of a split stay in the slot of their cell,
+// merged cells free theirs. Second halves fill the free slots first, the
+// rest are refilled with the stipples of the highest slots.
+class StippleSlots {
+ public:
+  void reset(size_t count) {
+    m_slots.resize(count);
+    std::iota(m_slots.begin(), m_slots.end(), 0);
+    m_reported.clear();
+    m_reportedSize = 0;
+  }
+
+  // origin holds the previous index of the cell of every new stipple.
+  void update(const std::vector<uint32_t> &origin) {
+    const size_t count = origin.size();
+    size_t slotCount = m_slots.size();
+
+    std::vector<char> kept(m_slots.size(), 0);
+    std::vector<uint32_t> assigned(count);
+    std::vector<uint32_t> seconds;
+    for (size_t i = 0; i < count; ++i) {
+      if (!kept[origin[i]]) {
+        kept[origin[i]] = 1;
+        assigned[i] = m_slots[origin[i]];
+      } else {
+        seconds.push_back(i);
+      }
+    }
+
+    std::vector<uint32_t> free;
+    for (size_t o = 0; o < m_slots.size(); ++o) {
+      if (!kept[o]) free.push_back(m_slots[o]);
+    }
+    for (uint32_t i : seconds) {
+      if (free.empty()) {
+        assigned[i] = slotCount++;
+      } else {
+        assigned[i] = free.back();
+        free.pop_back();
+      }
+    }
+
+    if (!free.empty()) {
+      // as many slots above count are taken as are free below it
+      std::vector<int64_t> owner(slotCount, -1);
+      for (size_t i = 0; i < count; ++i) owner[assigned[i]] = i;
+      std::sort(free.begin(), free.end());
+      auto target = free.begin();
+      for (size_t s = count; s < slotCount; ++s) {
+        if (owner[s] >= 0) assigned[owner[s]] = *target++;
+      }
+    }
+    m_slots.swap(assigned);
+  }
+
+  StippleDelta delta(const std::vector<Stipple> &stipples) {
+    StippleDelta delta{stipples.size(), {}};
+    m_reported.resize(stipples.size());
+    for (size_t i = 0; i < stipples.size(); ++i) {
+      Stipple &reported = m_reported[m_slots[i]];
+      if (reported != stipples[i] || m_slots[i] >= m_reportedSize) {
+        reported = stipples[i];
+        delta.changed.emplace_back(m_slots[i], stipples[i]);
+      }
+    }
+    m_reportedSize = stipples.size();
+    return delta;
+  }
+
+ private:
+  // slot of every current stipple
+  std::vector<uint32_t> m_slots;
+  std::vector<Stipple> m_reported;
+  size_t m_reportedSize = 0;
+};
+
+LBGStippling::LBGStippling()
+    : m_cancel(nullptr), m_voronoiPool(std::make_shared<VoronoiPool>()) {
   m_statusCallback = [](const Status &) {};
   m_stippleCallback = [](const std::vector<Stipple> &) {};
 }
@@ -87,86 +351,315 @@ void LBGStippling::setStippleCallback(Report<std::vector<Stipple>> stippleCB) {
   m_stippleCallback = stippleCB;
 }
 
-std::vector<Stipple> LBGStippling::stipple(const QImage &density,
-                                           const Params &params) const {
-  QImage densityGray =
-      density
-          .scaledToWidth(params.superSamplingFactor * density.width(),
-                         Qt::SmoothTransformation)
-          .convertToFormat(QImage::Format_Grayscale8);
+void LBGStippling::setDeltaCallback(Report<StippleDelta> deltaCB) {
+  m_deltaCallback = deltaCB;
+}
+
+void LBGStippling::setCheckpointCallback(Report<Checkpoint> checkpointCB) {
+  m_checkpointCallback = checkpointCB;
+}
+
+void LBGStippling::setCancelFlag(const std::atomic<bool> *cancel) {
+  m_cancel = cancel;
+}
 
-  VoronoiDiagram voronoi(densityGray);
+void LBGStippling::setCache(std::shared_ptr<StippleCache> cache) {
+  m_cache = std::move(cache);
+}
 
-  std::vector<Stipple> stipples =
-      randomStipples(params.initialPoints, params.initialPointSize);
+void LBGStippling::prepareOpenGL() const { m_voronoiPool->prepareOpenGL(); }
+
+void LBGStippling::releaseResources() const { m_voronoiPool->clear(); }
+
+void LBGStippling::splitMerge(const std::vector<VoronoiCell> &cells,
+                              const DensityField &density, float scale,
+                              const Params &params, Status &status,
+                              std::mt19937 &random,
+                              std::vector<Stipple> &stipples,
+                              std::vector<uint32_t> &origin) {
+  stipples.clear();
+  origin.clear();
+
+  status.splits = 0;
+  status.merges = 0;
+  const float hysteresis = status.hysteresis;
+
+  for (uint32_t c = 0; c < cells.size(); ++c) {
+    const VoronoiCell &cell = cells[c];
+    const float totalDensity = cell.sumDensity;
+    const float diameter = stippleSize(cell, params);
+
+    if (totalDensity < getSplitValueLower(diameter, hysteresis, scale) ||
+        cell.area == 0.0f) {
+      // cell too small - merge
+      ++status.merges;
+      continue;
+    }
 
-  Status status = {0, 0, 1, 1, params.hysteresis};
+    if (totalDensity < getSplitValueUpper(diameter, hysteresis, scale)) {
+      // cell size within acceptable range - keep
+      stipples.push_back({cell.centroid, diameter, Qt::black});
+      origin.push_back(c);
+      continue;
+    }
 
-  while (notFinished(status, params)) {
-    status.splits = 0;
-    status.merges = 0;
-    auto indexMap = voronoi.calculate(sites(stipples));
-    std::vector<VoronoiCell> cells = accumulateCells(indexMap, densityGray);
+    // cell too large - split
+    const float area = std::max(1.0f, cell.area);
+    const float circleRadius = std::sqrt(area / M_PIf32);
+    QVector2D splitVector = QVector2D(0.5f * circleRadius, 0.0f);
 
-    assert(cells.size() == stipples.size());
+    const float a = cell.orientation;
+    QVector2D splitVectorRotated = QVector2D(
+        splitVector.x() * std::cos(a) - splitVector.y() * std::sin(a),
+        splitVector.y() * std::cos(a) + splitVector.x() * std::sin(a));
 
-    stipples.clear();
+    splitVectorRotated.setX(splitVectorRotated.x() / density.width());
+    splitVectorRotated.setY(splitVectorRotated.y() / density.height());
 
-    float hysteresis = currentHysteresis(status.iteration, params);
-    status.hysteresis = hysteresis;
+    QVector2D splitSeed1 = cell.centroid - splitVectorRotated;
+    QVector2D splitSeed2 = cell.centroid + splitVectorRotated;
 
-    for (const auto &cell : cells) {
-      const float totalDensity = cell.sumDensity;
-      const float diameter = stippleSize(cell, params);
+    // check boundaries
+    splitSeed1.setX(std::max(0.0f, std::min(splitSeed1.x(), 1.0f)));
+    splitSeed1.setY(std::max(0.0f, std::min(splitSeed1.y(), 1.0f)));
 
-      if (totalDensity < getSplitValueLower(diameter, hysteresis,
-                                            params.superSamplingFactor) ||
-          cell.area == 0.0f) {
-        // cell too small - merge
-        ++status.merges;
-        continue;
-      }
+    splitSeed2.setX(std::max(0.0f, std::min(splitSeed2.x(), 1.0f)));
+    splitSeed2.setY(std::max(0.0f, std::min(splitSeed2.y(), 1.0f)));
+
+    stipples.push_back({jitter(splitSeed1, random), diameter, Qt::red});
+    stipples.push_back({jitter(splitSeed2, random), diameter, Qt::red});
+    origin.insert(origin.end(), 2, c);
+
+    ++status.splits;
+  }
+}
+
+std::vector<Stipple> LBGStippling::stipple(const QImage &density,
+                                           const Params &params) const {
+  // shallow copy if the image is already grayscale
+  const QImage gray = density.convertToFormat(QImage::Format_Grayscale8);
+
+  std::vector<Stipple> stipples;
+  stipple(GrayView{gray.constBits(), gray.width(), gray.height(),
+                   gray.bytesPerLine()},
+          params, stipples);
+  return stipples;
+}
+
+Status LBGStippling::stipple(const GrayView &density, const Params &params,
+                             std::vector<Stipple> &stipples) const {
+  if (!m_cache || params.seed == 0) {
+    return run(density, params, nullptr, stipples);
+  }
 
-      if (totalDensity < getSplitValueUpper(diameter, hysteresis,
-                                            params.superSamplingFactor)) {
-        // cell size within acceptable range - keep
-        stipples.push_back({cell.centroid, diameter, Qt::black});
-        continue;
+  const StippleCache::Key key = StippleCache::key(density, params);
+  Checkpoint cached;
+  if (m_cache->find(key, cached)) {
+    stipples = cached.stipples;
+    Status status = {};
+    status.iteration = cached.iteration;
+    status.size = stipples.size();
+    status.hysteresis = cached.hysteresis;
+    status.converged = cached.converged;
+    m_stippleCallback(stipples);
+    if (m_deltaCallback) {
+      StippleDelta delta{stipples.size(), {}};
+      for (size_t i = 0; i < stipples.size(); ++i) {
+        delta.changed.emplace_back(i, stipples[i]);
       }
+      m_deltaCallback(delta);
+    }
+    m_statusCallback(status);
+    return status;
+  }
 
-      // cell too large - split
-      const float area = std::max(1.0f, cell.area);
-      const float circleRadius = std::sqrt(area / M_PIf32);
-      QVector2D splitVector = QVector2D(0.5f * circleRadius, 0.0f);
+  const bool warm = m_cache->findWarmStart(key, params, cached);
+  const Status status =
+      run(density, params, warm ? &cached : nullptr, stipples);
+  if (status.converged || status.iteration >= params.maxIterations) {
+    m_cache->insert(key, Checkpoint{params, status.iteration, 0,
+                                    status.hysteresis, stipples,
+                                    status.converged});
+  }
+  return status;
+}
 
-      const float a = cell.orientation;
-      QVector2D splitVectorRotated = QVector2D(
-          splitVector.x() * std::cos(a) - splitVector.y() * std::sin(a),
-          splitVector.y() * std::cos(a) + splitVector.x() * std::sin(a));
+Status LBGStippling::resume(const GrayView &density,
+                            const Checkpoint &checkpoint, const Params &params,
+                            std::vector<Stipple> &stipples) const {
+  return run(density, params, &checkpoint, stipples);
+}
 
-      splitVectorRotated.setX(splitVectorRotated.x() / densityGray.width());
-      splitVectorRotated.setY(splitVectorRotated.y() / densityGray.height());
+Status LBGStippling::run(const GrayView &density, const Params &params,
+                         const Checkpoint *checkpoint,
+                         std::vector<Stipple> &stipples) const {
+  const Stopwatch runTime;
+  Stopwatch stopwatch;
+  const std::vector<DensityField> pyramid = densityPyramid(density, params);
+  const double densityTime = stopwatch.elapsed();
+  size_t pyramidBytes = 0;
+  for (const DensityField &field : pyramid) pyramidBytes += field.bytes();
+  size_t level = pyramid.size() - 1;
+  if (checkpoint) level = std::min(level, checkpoint->level);
+
+  VoronoiPool::Handle voronoi =
+      m_voronoiPool->acquire(params.voronoiBackend, pyramid[level]);
+
+  // A drawn seed is stored in the checkpoints, a resumed run keeps the seed
+  // of its checkpoint unless another one is given.
+  Params checkpointParams = params;
+  if (params.seed == 0) {
+    checkpointParams.seed = checkpoint && checkpoint->params.seed != 0
+                                ? checkpoint->params.seed
+                                : std::max(1u, std::random_device{}());
+  }
+  const uint32_t seed = checkpointParams.seed;
+  std::mt19937 random;
+  reseed(random, seed, initialStream);
+  if (checkpoint) {
+    stipples = checkpoint->stipples;
+  } else if (params.densityInitialization) {
+    densityStipples(pyramid[level],
+                    float(pyramid[level].width()) / density.width, params,
+                    random, stipples);
+  } else {
+    randomStipples(params.initialPoints, params.initialPointSize, random,
+                   stipples);
+  }
 
-      QVector2D splitSeed1 = cell.centroid - splitVectorRotated;
-      QVector2D splitSeed2 = cell.centroid + splitVectorRotated;
+  Status status = {};
+  status.splits = 1;
+  status.merges = 1;
+  status.hysteresis = params.hysteresis;
+  if (checkpoint) {
+    status.iteration = checkpoint->iteration;
+    status.hysteresis = checkpoint->hysteresis;
+  }
+  const size_t firstIteration = status.iteration;
 
-      // check boundaries
-      splitSeed1.setX(std::max(0.0f, std::min(splitSeed1.x(), 1.0f)));
-      splitSeed1.setY(std::max(0.0f, std::min(splitSeed1.y(), 1.0f)));
+  StippleSlots stippleSlots;
+  std::vector<uint32_t> origin;
+  stippleSlots.reset(stipples.size());
 
-      splitSeed2.setX(std::max(0.0f, std::min(splitSeed2.x(), 1.0f)));
-      splitSeed2.setY(std::max(0.0f, std::min(splitSeed2.y(), 1.0f)));
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point lastReport = Clock::now();
+  bool reportedLast = false;
+  auto report = [&]() {
+    m_stippleCallback(stipples);
+    if (m_deltaCallback) m_deltaCallback(stippleSlots.delta(stipples));
+    lastReport = Clock::now();
+  };
+  auto reportDue = [&]() {
+    if (params.reportInterval == 0) return false;
+    if (params.reportIntervalMs > 0) {
+      return Clock::now() - lastReport >=
+             std::chrono::milliseconds(params.reportIntervalMs);
+    }
+    return (status.iteration + 1) % params.reportInterval == 0;
+  };
+
+  TimeBudget budget(params);
+  // stipples of the most stable finest level iteration, only with a budget
+  std::vector<Stipple> best;
+  float bestChangeRate = std::numeric_limits<float>::infinity();
+  bool bestIsCurrent = false;
+  bool outOfTime = false;
+
+  while (notFinished(status, params, level == 0) &&
+         !(m_cancel && m_cancel->load())) {
+    if (budget.affordable(runTime.elapsed(), pyramid[level]) < 1.0) {
+      outOfTime = true;
+      break;
+    }
+    const double iterationStart = runTime.elapsed();
+    const DensityField &densityField = pyramid[level];
+    const float scale = float(densityField.width()) / density.width;
 
-      stipples.push_back({jitter(splitSeed1), diameter, Qt::red});
-      stipples.push_back({jitter(splitSeed2), diameter, Qt::red});
+    status.timings = {};
+    if (status.iteration == firstIteration) {
+      status.timings.density = densityTime;
+    }
 
-      ++status.splits;
+    const QVector<QVector2D> points = sites(stipples);
+    std::vector<VoronoiCell> cells;
+    if (params.fusedAccumulation) {
+      cells = voronoi->calculateCells(points, densityField);
+    } else {
+      const IndexMap map = voronoi->calculate(points);
+      stopwatch.restart();
+      cells = accumulateCells(map, densityField);
+      status.timings.accumulate = stopwatch.elapsed();
     }
+
+    assert(cells.size() == stipples.size());
+
+    const VoronoiDiagram::Stats &stats = voronoi->stats();
+    status.timings.raster = stats.raster;
+    status.timings.readback = stats.readback;
+    status.timings.accumulate += stats.accumulate;
+    status.pixels = stats.pixels;
+    status.residual = residual(points, cells, density);
+    stopwatch.restart();
+
+    status.hysteresis =
+        budget.enabled()
+            ? budget.hysteresis(status.iteration, status.hysteresis,
+                                runTime.elapsed(), densityField)
+            : currentHysteresis(status.iteration, params);
+    reseed(random, seed, status.iteration);
+    splitMerge(cells, densityField, scale, params, status, random, stipples,
+               origin);
     status.size = stipples.size();
-    m_stippleCallback(stipples);
+    status.timings.splitMerge = stopwatch.elapsed();
+    status.bytesAllocated = pyramidBytes + voronoi->bytes() +
+                            points.capacity() * sizeof(QVector2D) +
+                            cells.capacity() * sizeof(VoronoiCell) +
+                            stipples.capacity() * sizeof(Stipple);
+    status.converged =
+        level == 0 && status.splits == 0 && status.merges == 0;
+
+    if (budget.enabled() && level == 0) {
+      // later iterations win ties, they have seen more of the density
+      const float changeRate = float(status.splits + status.merges) /
+                               std::max<size_t>(1, cells.size());
+      bestIsCurrent = changeRate <= bestChangeRate;
+      if (bestIsCurrent) {
+        bestChangeRate = changeRate;
+        best = stipples;
+      }
+    }
+
+    if (m_deltaCallback) stippleSlots.update(origin);
+    reportedLast = reportDue();
+    if (reportedLast) report();
     m_statusCallback(status);
 
+    budget.finished(runTime.elapsed() - iterationStart, densityField);
+    if (level > 0 &&
+        levelUp(status, densityField, level, params,
+                budget.affordable(runTime.elapsed(), pyramid[level - 1]))) {
+      --level;
+      // release first, so the pool can resize it
+      voronoi.reset();
+      voronoi = m_voronoiPool->acquire(params.voronoiBackend, pyramid[level]);
+    }
+
+    if (m_checkpointCallback && params.checkpointInterval > 0 &&
+        (status.iteration + 1) % params.checkpointInterval == 0) {
+      m_checkpointCallback(Checkpoint{checkpointParams, status.iteration + 1,
+                                      level, status.hysteresis, stipples});
+    }
+
     ++status.iteration;
   }
-  return stipples;
+
+  if (outOfTime && !best.empty() && !bestIsCurrent) {
+    stipples.swap(best);
+    status.size = stipples.size();
+    // the slots belong to the replaced stipples, so all are reported again
+    stippleSlots.reset(stipples.size());
+    reportedLast = false;
+  }
+  if (!reportedLast) report();
+  return status;
 }
@@ -1,11 +1,18 @@
 #ifndef LBGSTIPPLING_H
 #define LBGSTIPPLING_H
 
+#include "densityfield.h"
 #include "voronoidiagram.h"
+#include "voronoipool.h"
 
 #include <QImage>
 #include <QVector2D>
 
+#include <atomic>
+#include <random>
+
+class StippleCache;
+
 // TODO: Color is only used for debugging
 struct Stipple {
   QVector2D pos;
@@ -13,11 +20,36 @@ struct Stipple {
   QColor color;
 };
 
+inline bool operator==(const Stipple& a, const Stipple& b) {
+  return a.pos == b.pos && a.size == b.size && a.color == b.color;
+}
+
+inline bool operator!=(const Stipple& a, const Stipple& b) {
+  return !(a == b);
+}
+
+// Changes since the previous report, for consumers that keep their own copy
+// of the stipples. Every stipple keeps its slot in that copy for as long as
+// it is kept or moved, so only new, moved and relocated stipples are listed.
+// The order of the slots is unrelated to the order of the final result.
+struct StippleDelta {
+  size_t size;
+  std::vector<std::pair<uint32_t, Stipple>> changed;
+
+  void apply(std::vector<Stipple>& stipples) const {
+    stipples.resize(size);
+    for (const auto& c : changed) stipples[c.first] = c.second;
+  }
+};
+
 class LBGStippling {
  public:
   struct Params {
     size_t initialPoints = 1;
     float initialPointSize = 4.0f;
+    // Starts from the estimated final number of stipples instead, at least
+    // initialPoints, placed by stratified importance sampling of the density.
+    bool densityInitialization = false;
 
     bool adaptivePointSize = true;
     float pointSizeMin = 2.0f;
@@ -28,6 +60,54 @@ class LBGStippling {
 
     float hysteresis = 0.6f;
     float hysteresisDelta = 0.01f;
+
+    // Number of density pyramid levels, each half the resolution of the
+    // next. Iterations start on the coarsest level and move up once less
+    // than levelUpRate of the stipples were split or merged, or the stipples
+    // get too dense for the level. 1 disables the pyramid.
+    size_t pyramidLevels = 1;
+    float levelUpRate = 0.1f;
+
+    // Intermediate results are reported every reportInterval iterations, or
+    // at most every reportIntervalMs milliseconds if that is nonzero. The
+    // final result is always reported, an interval of 0 reports only that.
+    size_t reportInterval = 1;
+    size_t reportIntervalMs = 0;
+
+    // Wall-clock budget of a run in milliseconds, 0 for none. No iteration
+    // is started that is not expected to finish in time. If the planned
+    // iterations do not fit, the hysteresis is raised faster to converge
+    // sooner. A run that is out of time returns the stipples of the finest
+    // level iteration that changed the fewest of them.
+    size_t timeBudgetMs = 0;
+
+    // A checkpoint is passed to the checkpoint callback every
+    // checkpointInterval iterations, 0 for none.
+    size_t checkpointInterval = 0;
+
+    // Seed of the initial stipples and of the jitter of split stipples. Runs
+    // with the same seed and params give the same result, 0 draws a new
+    // seed for every run.
+    uint32_t seed = 0;
+
+    // Runs on the CPU backend can run at once on any number of threads.
+    // OpenGL runs of an instance and all its copies share one context, so
+    // they have to run one after another on the thread that ran the first.
+    // Runs off the GUI thread use the CPU unless prepareOpenGL() was called.
+    VoronoiDiagram::Backend voronoiBackend = VoronoiDiagram::Backend::OpenGL;
+    // Accumulate cells while the diagram is computed instead of storing the
+    // full index map first, if the backend supports it.
+    bool fusedAccumulation = true;
+  };
+
+  // Wall-clock milliseconds spent in each phase of an iteration. The density
+  // pyramid is built before the first iteration and counted there.
+  struct Timings {
+    double density;
+    double raster;
+    double readback;
+    double accumulate;
+    double splitMerge;
   };
 
   struct Status {
@@ -36,6 +116,31 @@ class LBGStippling {
     size_t splits;
     size_t merges;
     float hysteresis;
+    Timings timings;
+    // memory held by the density pyramid, the Voronoi diagram, the cells
+    // and the stipples
+    size_t bytesAllocated;
+    // pixels assigned to a site by the Voronoi diagram
+    size_t pixels;
+    // mean distance between the sites and the centroids of their cells, in
+    // input pixels
+    float residual;
+    // no stipple was split or merged on the finest level
+    bool converged;
+  };
+
+  // State of a run between two iterations, enough to resume it.
+  struct Checkpoint {
+    Params params;
+    // the next iteration to run
+    size_t iteration;
+    // pyramid level of the next iteration, 0 is the finest
+    size_t level;
+    // hysteresis of the last iteration
+    float hysteresis;
+    std::vector<Stipple> stipples;
+    // only set for the result of a run that converged
+    bool converged = false;
   };
 
   template <class T>
@@ -46,13 +151,69 @@ class LBGStippling {
   std::vector<Stipple> stipple(const QImage& density,
                                const Params& params) const;
 
+  // Stipples a caller-owned grayscale buffer without copying it. The result
+  // replaces the contents of stipples, reusing its capacity. Returns the
+  // status of the last iteration.
+  Status stipple(const GrayView& density, const Params& params,
+                 std::vector<Stipple>& stipples) const;
+
+  // Continues a run from a checkpoint of the same density. The params may
+  // differ from those of the checkpoint, e.g. to warm-start a run with a
+  // different hysteresis. A seed of 0 keeps the seed of the checkpoint.
+  Status resume(const GrayView& density, const Checkpoint& checkpoint,
+                const Params& params, std::vector<Stipple>& stipples) const;
+
   // TODO: Rename and method chaining.
   void setStatusCallback(Report<Status> statusCB);
   void setStippleCallback(Report<std::vector<Stipple>> stippleCB);
+  // Only tracked if set, follows the same schedule as the stipple callback.
+  void setDeltaCallback(Report<StippleDelta> deltaCB);
+  void setCheckpointCallback(Report<Checkpoint> checkpointCB);
+
+  // Checked between iterations, a run that sees it set returns the stipples
+  // of its last iteration. The flag must outlive all runs.
+  void setCancelFlag(const std::atomic<bool>* cancel);
+
+  // Finished runs of a grayscale buffer are looked up in the cache first and
+  // stored there afterwards. A hit is reported as the final result right
+  // away, runs that only differ from a cached one in maxIterations or the
+  // hysteresis continue from it. Cancelled runs and runs out of time are not
+  // stored, neither are runs with a seed of 0, which draw a new one.
+  void setCache(std::shared_ptr<StippleCache> cache);
+
+  // One split and merge step of an iteration, exposed for benchmarks. The
+  // stipples are replaced by those of the given cells, origin receives the
+  // cell of every new stipple. Uses the hysteresis of the status and counts
+  // the splits and merges there. The scale is the number of density pixels
+  // per input pixel along an axis, split stipples are jittered by random.
+  static void splitMerge(const std::vector<VoronoiCell>& cells,
+                         const DensityField& density, float scale,
+                         const Params& params, Status& status,
+                         std::mt19937& random, std::vector<Stipple>& stipples,
+                         std::vector<uint32_t>& origin);
+
+  // Creates the OpenGL surface up front, so that runs on other threads can
+  // use the OpenGL backend. Must be called on the GUI thread.
+  void prepareOpenGL() const;
+
+  // Frees the pooled Voronoi diagrams. OpenGL resources have to be freed on
+  // the thread that ran the stippling.
+  void releaseResources() const;
 
  private:
   Report<Status> m_statusCallback;
   Report<std::vector<Stipple>> m_stippleCallback;
+  Report<StippleDelta> m_deltaCallback;
+  Report<Checkpoint> m_checkpointCallback;
+  const std::atomic<bool>* m_cancel;
+  // Keeps the Voronoi diagrams warm across calls, shared between copies.
+  std::shared_ptr<VoronoiPool> m_voronoiPool;
+  std::shared_ptr<StippleCache> m_cache;
+
+  // Starts from the checkpoint if there is one.
+  Status run(const GrayView& density, const Params& params,
+             const Checkpoint* checkpoint,
+             std::vector<Stipple>& stipples) const;
 };
 
 #endif  // LBGSTIPPLING_H
@@ -28,7 +28,7 @@ MainWindow::MainWindow() {
   m_statusBar->setSizeGripEnabled(false);
   setStatusBar(m_statusBar);
 
-  connect(m_stippleViewer, &StippleViewer::iterationStatus,
+  connect(m_stippleViewer, &StippleViewer::iterationStatus, this,
           [this](int iteration, int numberPoints, int splits, int merges,
                  float hysteresis) {
             m_statusBar->showMessage(
@@ -39,6 +39,6 @@ MainWindow::MainWindow() {
                 " | Splits: " + QString::number(splits) +
                 " | Merges: " + QString::number(merges));
           });
-  connect(m_stippleViewer, &StippleViewer::inputImageChanged,
+  connect(m_stippleViewer, &StippleViewer::inputImageChanged, this,
           [this]() { m_statusBar->clearMessage(); });
 }
@@ -0,0 +1,285 @@
+#include "mappedgrayimage.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace {
+
+// TIFF tags and field types, see the TIFF 6.0 specification
+enum TiffTag : uint16_t {
+  ImageWidth = 256,
+  ImageLength = 257,
+  BitsPerSample = 258,
+  Compression = 259,
+  PhotometricInterpretation = 262,
+  StripOffsets = 273,
+  SamplesPerPixel = 277,
+  RowsPerStrip = 278,
+  PlanarConfiguration = 284,
+};
+
+enum TiffType : uint16_t { Short = 3, Long = 4 };
+
+}  // namespace
+
+MappedGrayImage::MappedGrayImage(const QString &path)
+    : m_file(path),
+      m_data(nullptr),
+      m_fileSize(0),
+      m_bits(8),
+      m_maxValue(255),
+      m_bigEndian(false),
+      m_invert(false),
+      m_rowsPerStrip(0) {
+  if (!map()) return;
+  const bool parsed = m_fileSize >= 2 && std::memcmp(m_data, "P5", 2) == 0
+                          ? parsePGM()
+                          : parseTIFF();
+  if (!parsed || !checkRows()) m_data = nullptr;
+}
+
+MappedGrayImage::MappedGrayImage(const QString &path, const QSize &size,
+                                 int bitsPerSample, qint64 offset,
+                                 bool bigEndian)
+    : m_file(path),
+      m_data(nullptr),
+      m_fileSize(0),
+      m_size(size),
+      m_bits(bitsPerSample),
+      m_maxValue((1u << bitsPerSample) - 1),
+      m_bigEndian(bigEndian),
+      m_invert(false),
+      m_stripOffsets{offset},
+      m_rowsPerStrip(size.height()) {
+  if (bitsPerSample != 8 && bitsPerSample != 16) {
+    fail("only 8 and 16 bit samples are supported");
+    return;
+  }
+  if (!map() || !checkRows()) m_data = nullptr;
+}
+
+bool MappedGrayImage::hasView() const {
+  return isValid() && m_bits == 8 && m_maxValue == 255 && !m_invert &&
+         m_stripOffsets.size() == 1;
+}
+
+GrayView MappedGrayImage::view() const {
+  return {row(0), m_size.width(), m_size.height(),
+          static_cast<int32_t>(rowBytes())};
+}
+
+void MappedGrayImage::read(const QRect &region, uchar *pixels,
+                           int32_t stride) const {
+  const int32_t x0 = region.x();
+  const int32_t width = region.width();
+  for (int32_t y = 0; y < region.height(); ++y) {
+    const uchar *src = row(region.y() + y);
+    uchar *dst = pixels + std::ptrdiff_t(y) * stride;
+    if (m_bits == 8) {
+      if (m_maxValue == 255) {
+        std::memcpy(dst, src + x0, width);
+      } else {
+        for (int32_t x = 0; x < width; ++x) {
+          dst[x] = (std::min<uint32_t>(src[x0 + x], m_maxValue) * 255 +
+                    m_maxValue / 2) /
+                   m_maxValue;
+        }
+      }
+    } else {
+      const uchar *s = src + 2 * x0;
+      for (int32_t x = 0; x < width; ++x, s += 2) {
+        const uint32_t v =
+            m_bigEndian ? (s[0] << 8) | s[1] : (s[1] << 8) | s[0];
+        dst[x] =
+            (std::min(v, m_maxValue) * 255 + m_maxValue / 2) / m_maxValue;
+      }
+    }
+    if (m_invert) {
+      for (int32_t x = 0; x < width; ++x) dst[x] = 255 - dst[x];
+    }
+  }
+}
+
+bool MappedGrayImage::map() {
+  if (!m_file.open(QIODevice::ReadOnly)) return fail(m_file.errorString());
+  m_fileSize = m_file.size();
+  m_data = m_fileSize > 0 ? m_file.map(0, m_fileSize) : nullptr;
+  if (!m_data) return fail("could not map the file");
+  return true;
+}
+
+bool MappedGrayImage::fail(const QString &error) {
+  m_error = error;
+  return false;
+}
+
+// "P5", then width, height and the largest value as decimal numbers, each
+// preceded by whitespace or comments, and a single whitespace character.
+
+bool MappedGrayImage::parsePGM() {
+  qint64 pos = 2;
+  auto number = [&](uint32_t &value) {
+    while (pos < m_fileSize) {
+      if (m_data[pos] == '#') {
+        while (pos < m_fileSize && m_data[pos] != '\n') ++pos;
+      } else if (std::isspace(m_data[pos])) {
+        ++pos;
+      } else {
+        break;
+      }
+    }
+    if (pos >= m_fileSize || !std::isdigit(m_data[pos])) return false;
+    uint64_t v = 0;
+    while (pos < m_fileSize && std::isdigit(m_data[pos]) && v < (1u << 31)) {
+      v = 10 * v + (m_data[pos++] - '0');
+    }
+    value = static_cast<uint32_t>(v);
+    return true;
+  };
+
+  uint32_t width, height;
+  if (!number(width) || !number(height) || !number(m_maxValue) ||
+      pos >= m_fileSize) {
+    return fail("broken PGM header");
+  }
+  if (m_maxValue == 0 || m_maxValue > 65535) {
+    return fail("invalid PGM maximum value");
+  }
+
+  m_size = QSize(width, height);
+  m_bits = m_maxValue < 256 ? 8 : 16;
+  m_bigEndian = true;
+  m_stripOffsets = {pos + 1};
+  m_rowsPerStrip = height;
+  return true;
+}
+
+bool MappedGrayImage::parseTIFF() {
+  if (m_fileSize < 8) return fail("unknown file format");
+  if (std::memcmp(m_data, "II*\0", 4) == 0) {
+    m_bigEndian = false;
+  } else if (std::memcmp(m_data, "MM\0*", 4) == 0) {
+    m_bigEndian = true;
+  } else {
+    return fail("unknown file format, expected PGM or TIFF");
+  }
+
+  auto u16 = [&](qint64 at) -> uint32_t {
+    if (at + 2 > m_fileSize) return 0;
+    const uchar *p = m_data + at;
+    return m_bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+  };
+  auto u32 = [&](qint64 at) -> uint32_t {
+    return m_bigEndian ? (u16(at) << 16) | u16(at + 2)
+                       : (u16(at + 2) << 16) | u16(at);
+  };
+
+  // only the first image of the file
+  const qint64 ifd = u32(4);
+  const uint32_t entries = u16(ifd);
+  if (ifd == 0 || ifd + 2 + 12 * qint64(entries) > m_fileSize) {
+    return fail("broken TIFF directory");
+  }
+
+  uint32_t width = 0;
+  uint32_t height = 0;
+  uint32_t samples = 1;
+  uint32_t compression = 1;
+  uint32_t photometric = 1;
+  uint32_t planar = 1;
+  uint32_t rowsPerStrip = 0xffffffff;
+  m_bits = 1;
+  m_stripOffsets.clear();
+
+  for (uint32_t i = 0; i < entries; ++i) {
+    const qint64 entry = ifd + 2 + 12 * qint64(i);
+    const uint32_t tag = u16(entry);
+    const uint32_t type = u16(entry + 2);
+    const uint32_t count = u32(entry + 4);
+    const uint32_t size = type == Short ? 2 : 4;
+    // values that fit into four bytes are stored in place
+    const qint64 values =
+        qint64(count) * size <= 4 ? entry + 8 : qint64(u32(entry + 8));
+    auto value = [&](uint32_t index) {
+      return type == Short ? u16(values + 2 * index) : u32(values + 4 * index);
+    };
+    if (type != Short && type != Long) continue;
+
+    switch (tag) {
+      case ImageWidth: width = value(0); break;
+      case ImageLength: height = value(0); break;
+      case BitsPerSample: m_bits = value(0); break;
+      case Compression: compression = value(0); break;
+      case PhotometricInterpretation: photometric = value(0); break;
+      case SamplesPerPixel: samples = value(0); break;
+      case RowsPerStrip: rowsPerStrip = value(0); break;
+      case PlanarConfiguration: planar = value(0); break;
+      case StripOffsets:
+        if (values + qint64(count) * size > m_fileSize) {
+          return fail("broken TIFF strip offsets");
+        }
+        for (uint32_t s = 0; s < count; ++s) {
+          m_stripOffsets.push_back(value(s));
+        }
+        break;
+      default: break;
+    }
+  }
+
+  if (compression != 1) return fail("compressed TIFF is not supported");
+  if (samples != 1 || photometric > 1 || planar != 1) {
+    return fail("only grayscale TIFF is supported");
+  }
+  if (m_bits != 8 && m_bits != 16) {
+    return fail("only 8 and 16 bit TIFF is supported");
+  }
+  if (width == 0 || height == 0 || rowsPerStrip == 0 ||
+      m_stripOffsets.empty()) {
+    return fail("broken TIFF directory");
+  }
+
+  m_size = QSize(width, height);
+  m_maxValue = (1u << m_bits) - 1;
+  m_invert = photometric == 0;
+  m_rowsPerStrip = std::min(rowsPerStrip, height);
+
+  // strips that follow each other directly count as one
+  bool contiguous = true;
+  for (size_t s = 1; s < m_stripOffsets.size(); ++s) {
+    contiguous &= m_stripOffsets[s] ==
+                  m_stripOffsets[s - 1] + m_rowsPerStrip * rowBytes();
+  }
+  if (contiguous) {
+    m_stripOffsets.resize(1);
+    m_rowsPerStrip = height;
+  }
+  return true;
+}
+
+bool MappedGrayImage::checkRows() {
+  if (m_size.isEmpty()) return fail("empty image");
+  const int32_t strips =
+      (m_size.height() + m_rowsPerStrip - 1) / m_rowsPerStrip;
+  if (qint64(m_stripOffsets.size()) < strips) {
+    return fail("missing strips");
+  }
+  for (int32_t s = 0; s < strips; ++s) {
+    const int32_t rows =
+        std::min(m_rowsPerStrip, m_size.height() - s * m_rowsPerStrip);
+    if (m_stripOffsets[s] < 0 ||
+        m_stripOffsets[s] + rows * rowBytes() > m_fileSize) {
+      return fail("file is truncated");
+    }
+  }
+  return true;
+}
+
+qint64 MappedGrayImage::rowBytes() const {
+  return qint64(m_size.width()) * (m_bits / 8);
+}
+
+const uchar *MappedGrayImage::row(int32_t y) const {
+  return m_data + m_stripOffsets[y / m_rowsPerStrip] +
+         (y % m_rowsPerStrip) * rowBytes();
+}
@@ -0,0 +1,72 @@
+#ifndef MAPPEDGRAYIMAGE_H
+#define MAPPEDGRAYIMAGE_H
+
+#include "densityfield.h"
+
+#include <QFile>
+#include <QRect>
+#include <QString>
+
+#include <vector>
+
+// Grayscale image in an uncompressed file, mapped into memory instead of
+// being decoded, so only the pages of the rows that are read get loaded.
+// Reads binary PGM (P5) and baseline TIFF with uncompressed 8 or 16 bit
+// grayscale strips, or raw 8 or 16 bit samples of a given size.
+class MappedGrayImage {
+ public:
+  // Detects PGM and TIFF by their header.
+  explicit MappedGrayImage(const QString& path);
+  // Raw row-major samples starting at offset, 16 bit ones little endian
+  // unless bigEndian is set.
+  MappedGrayImage(const QString& path, const QSize& size, int bitsPerSample,
+                  qint64 offset = 0, bool bigEndian = false);
+
+  MappedGrayImage(const MappedGrayImage&) = delete;
+  MappedGrayImage& operator=(const MappedGrayImage&) = delete;
+
+  bool isValid() const { return m_data != nullptr; }
+  QString errorString() const { return m_error; }
+
+  QSize size() const { return m_size; }
+  int bitsPerSample() const { return m_bits; }
+
+  // 8 bit images whose rows are evenly spaced in the file can be used
+  // without any copy.
+  bool hasView() const;
+  GrayView view() const;
+
+  // Writes the 8 bit gray values of a region to pixels, whose rows are
+  // stride bytes apart. Safe to call from several threads at once.
+  void read(const QRect& region, uchar* pixels, int32_t stride) const;
+
+ private:
+  QFile m_file;
+  const uchar* m_data;
+  qint64 m_fileSize;
+  QString m_error;
+
+  QSize m_size;
+  int m_bits;
+  // largest sample value, maps to white
+  uint32_t m_maxValue;
+  bool m_bigEndian;
+  // black is the largest value instead of zero
+  bool m_invert;
+
+  // file offset of every strip of rowsPerStrip rows
+  std::vector<qint64> m_stripOffsets;
+  int32_t m_rowsPerStrip;
+
+  bool map();
+  bool parsePGM();
+  bool parseTIFF();
+  bool fail(const QString& error);
+  // checks that all rows lie inside the file
+  bool checkRows();
+
+  qint64 rowBytes() const;
+  const uchar* row(int32_t y) const;
+};
+
+#endif  // MAPPEDGRAYIMAGE_H
@@ -0,0 +1,107 @@
+#include "parallel.h"
+
+#include <condition_variable>
+#include <list>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Indices of one parallelRun call, all counters are guarded by the mutex of
+// the pool.
+struct Job {
+  const std::function<void(int)>* f;
+  int count;
+  int threads;
+  int next;
+  int running;
+  int done;
+};
+
+// Fixed set of worker threads, started on first use. Waiting callers only
+// wait for indices that already run on another thread, whose nested calls
+// can always be finished by that thread itself, so nesting cannot deadlock.
+class ThreadPool {
+ public:
+  ThreadPool() : m_stop(false) {
+    const int threads = static_cast<int>(std::thread::hardware_concurrency());
+    for (int t = 1; t < threads; ++t) {
+      m_workers.emplace_back([this]() { work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& t : m_workers) t.join();
+  }
+
+  void run(int count, int threads, const std::function<void(int)>& f) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto job = m_jobs.insert(m_jobs.end(), Job{&f, count, threads, 0, 0, 0});
+    m_wake.notify_all();
+    while (job->done < count) {
+      if (available(*job)) {
+        execute(*job, lock);
+      } else {
+        m_finished.wait(lock);
+      }
+    }
+    m_jobs.erase(job);
+  }
+
+ private:
+  std::mutex m_mutex;
+  std::condition_variable m_wake;
+  std::condition_variable m_finished;
+  // oldest first
+  std::list<Job> m_jobs;
+  std::vector<std::thread> m_workers;
+  bool m_stop;
+
+  static bool available(const Job& job) {
+    return job.next < job.count && job.running < job.threads;
+  }
+
+  // Runs the next index of the job without holding the lock.
+  void execute(Job& job, std::unique_lock<std::mutex>& lock) {
+    const int i = job.next++;
+    ++job.running;
+    lock.unlock();
+    (*job.f)(i);
+    lock.lock();
+    --job.running;
+    if (++job.done == job.count) m_finished.notify_all();
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      auto job = std::find_if(m_jobs.begin(), m_jobs.end(), available);
+      if (job != m_jobs.end()) {
+        execute(*job, lock);
+        // a free thread may let the caller take the next index
+        m_finished.notify_all();
+      } else if (m_stop) {
+        return;
+      } else {
+        m_wake.wait(lock);
+      }
+    }
+  }
+};
+
+}  // namespace
+
+void parallelRun(int count, int threads, const std::function<void(int)>& f) {
+  if (count <= 0) return;
+  if (count == 1 || threads <= 1) {
+    for (int i = 0; i < count; ++i) f(i);
+    return;
+  }
+  static ThreadPool pool;
+  pool.run(count, threads, f);
+}
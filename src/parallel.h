@@ -0,0 +1,47 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <thread>
+
+// Number of contiguous chunks parallelFor splits a range of the given size
+// into. Useful for sizing per-thread accumulators up front.
+inline int parallelChunks(int count) {
+  const int threads = static_cast<int>(std::thread::hardware_concurrency());
+  return std::max(1, std::min(count, std::max(1, threads)));
+}
+
+// Calls f(i) for every i in [0, count) on the calling thread and the workers
+// of one process-wide pool with a thread less than the hardware has, on at
+// most the given number of threads at once. Calls from inside f share the
+// same workers, so nesting does not create more threads.
+void parallelRun(int count, int threads, const std::function<void(int)>& f);
+
+// Calls f(chunk, begin, end) for each of parallelChunks(count) contiguous
+// sub-ranges of [0, count).
+template <class F>
+void parallelFor(int count, F&& f) {
+  const int chunks = parallelChunks(count);
+  if (chunks == 1) {
+    f(0, 0, count);
+    return;
+  }
+  parallelRun(chunks, chunks, [&f, count, chunks](int c) {
+    const int begin = static_cast<int>(int64_t(count) * c / chunks);
+    const int end = static_cast<int>(int64_t(count) * (c + 1) / chunks);
+    f(c, begin, end);
+  });
+}
+
+// Calls f(i) for every i in [0, count) on up to the given number of threads,
+// each taking the next index once it is done with the last. Suits items of
+// uneven cost that parallelize internally. One thread is the calling thread,
+// the others come from the pool of parallelRun.
+template <class F>
+void parallelForEach(int count, int threads, F&& f) {
+  parallelRun(count, threads, [&f](int i) { f(i); });
+}
+
+#endif  // PARALLEL_H
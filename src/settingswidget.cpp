@@ -19,6 +19,16 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   connect(spinInitialPoints, QOverload<int>::of(&QSpinBox::valueChanged),
           [this](int value) { m_params.initialPoints = value; });
 
+  QCheckBox *densityInitialization =
+      new QCheckBox("Estimate initial points.", this);
+  densityInitialization->setChecked(m_params.densityInitialization);
+  densityInitialization->setToolTip(
+      "If enabled the algorithm starts with the number of points it is "
+      "expected to end with, placed according to the image, which saves "
+      "most of the iterations.");
+  connect(densityInitialization, &QCheckBox::clicked,
+          [this](bool value) { m_params.densityInitialization = value; });
+
   QLabel *initialPointSizeLabel = new QLabel("Point Size:", this);
   QDoubleSpinBox *spinInitialPointSize = new QDoubleSpinBox(this);
   spinInitialPointSize->setRange(0.1, 50.0);
@@ -75,6 +85,7 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   pointGroupLayout->addWidget(spinMinPointSize, 3, 1);
   pointGroupLayout->addWidget(maxPointSize, 4, 0);
   pointGroupLayout->addWidget(spinMaxPointSize, 4, 1);
+  pointGroupLayout->addWidget(densityInitialization, 5, 0);
 
   layout->addWidget(pointGroup);
 
@@ -127,6 +138,33 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   connect(spinSuperSample, QOverload<int>::of(&QSpinBox::valueChanged),
           [this](int value) { m_params.superSamplingFactor = value; });
 
+  QLabel *backendLabel = new QLabel("Voronoi Backend:", this);
+  QComboBox *comboBackend = new QComboBox(this);
+  comboBackend->addItem("OpenGL",
+                        static_cast<int>(VoronoiDiagram::Backend::OpenGL));
+  comboBackend->addItem("CPU", static_cast<int>(VoronoiDiagram::Backend::CPU));
+  comboBackend->setCurrentIndex(
+      comboBackend->findData(static_cast<int>(m_params.voronoiBackend)));
+  comboBackend->setToolTip(
+      "Where the Voronoi diagram is computed. The CPU backend uses all "
+      "cores and does not need a graphics card.");
+  connect(comboBackend, QOverload<int>::of(&QComboBox::currentIndexChanged),
+          [this, comboBackend](int index) {
+            m_params.voronoiBackend = static_cast<VoronoiDiagram::Backend>(
+                comboBackend->itemData(index).toInt());
+          });
+
+  QLabel *pyramidLabel = new QLabel("Pyramid Levels:", this);
+  QSpinBox *spinPyramid = new QSpinBox(this);
+  spinPyramid->setRange(1, 4);
+  spinPyramid->setValue(m_params.pyramidLevels);
+  spinPyramid->setToolTip(
+      "Starts on a density image downsampled this many times and moves to "
+      "the full resolution once the stipples settle. Speeds up the early "
+      "iterations.");
+  connect(spinPyramid, QOverload<int>::of(&QSpinBox::valueChanged),
+          [this](int value) { m_params.pyramidLevels = value; });
+
   QGridLayout *algoGroupLayout = new QGridLayout(algoGroup);
   algoGroup->setLayout(algoGroupLayout);
   algoGroupLayout->addWidget(hysteresisLabel, 0, 0);
@@ -137,6 +175,10 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   algoGroupLayout->addWidget(spinMaxIter, 2, 1);
   algoGroupLayout->addWidget(superSampleLabel, 3, 0);
   algoGroupLayout->addWidget(spinSuperSample, 3, 1);
+  algoGroupLayout->addWidget(backendLabel, 4, 0);
+  algoGroupLayout->addWidget(comboBackend, 4, 1);
+  algoGroupLayout->addWidget(pyramidLabel, 5, 0);
+  algoGroupLayout->addWidget(spinPyramid, 5, 1);
 
   layout->addWidget(algoGroup);
 
@@ -229,7 +271,12 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
   QVBoxLayout *startLayout = new QVBoxLayout(startGroup);
 
   QPushButton *startButton = new QPushButton("Start", this);
-  startLayout->addWidget(startButton);
+  QPushButton *cancelButton = new QPushButton("Cancel", this);
+  cancelButton->setEnabled(false);
+  QHBoxLayout *buttonLayout = new QHBoxLayout();
+  buttonLayout->addWidget(startButton);
+  buttonLayout->addWidget(cancelButton);
+  startLayout->addLayout(buttonLayout);
 
   connect(startButton, &QPushButton::released,
           [startButton]() { startButton->setEnabled(false); });
@@ -239,6 +286,14 @@ SettingsWidget::SettingsWidget(StippleViewer *stippleViewer, QWidget *parent)
           [startButton]() { startButton->setEnabled(true); });
   connect(startButton, &QPushButton::released,
           [fileButton]() { fileButton->setEnabled(false); });
+  connect(startButton, &QPushButton::released,
+          [cancelButton]() { cancelButton->setEnabled(true); });
+  connect(cancelButton, &QPushButton::released, [this, cancelButton]() {
+    cancelButton->setEnabled(false);
+    m_stippleViewer->cancel();
+  });
+  connect(m_stippleViewer, &StippleViewer::finished,
+          [cancelButton]() { cancelButton->setEnabled(false); });
 
   QProgressBar *progressBar = new QProgressBar(this);
   progressBar->setRange(0, 1);
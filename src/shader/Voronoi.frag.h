@@ -1,10 +1,12 @@
 std::string voronoiFragment = R"(#version 400 core
 
-in vec3 VertColor;
+flat in uint Index;
+in float RimDistance;
+flat in float RimStart;
 
-out vec4 fragColor;
+out uint fragIndex;
 
 void main()
 {
-	fragColor = vec4(VertColor, 1);
+	fragIndex = RimDistance > RimStart ? (Index | 0x80000000u) : Index;
 })";
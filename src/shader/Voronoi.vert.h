@@ -1,20 +1,30 @@
 std::string voronoiVertex = R"(#version 400 core
 layout(location = 0) in vec3 VertPosition;
 layout(location = 1) in vec2 ConePosition;
-layout(location = 2) in vec3 ConeColor;
+layout(location = 2) in float ConeRadius;
 
-out vec3 VertColor;
+uniform float maxRadius;
+uniform float pixelSize;
 
+flat out uint Index;
+out float RimDistance;
+flat out float RimStart;
 
-const float height = 1.99f;
-
+// rows are laid out top to bottom like the density image
 const mat4 projection = mat4(2.0f, 0.0f, 0.0f, 0.0f,
-                             0.0f, -2.0f, 0.0f, 0.0f,
-                             0.0f, 0.0f, -1.0f, 0.0f,
-                             -1.0f, 1.0f, 0.0f, 1.0f);
+                             0.0f, 2.0f, 0.0f, 0.0f,
+                             0.0f, 0.0f, 1.0f, 0.0f,
+                             -1.0f, -1.0f, -1.0f, 1.0f);
 
 void main()
 {
-	VertColor = ConeColor;
-	gl_Position = projection * vec4(VertPosition.xy + ConePosition, VertPosition.z + (1.0 - height), 1.0f);
+	Index = uint(gl_InstanceID);
+
+	// Cones smaller than the whole frame flag the last two pixels before
+	// their rim, a winning fragment there means the cell may be clipped.
+	RimDistance = VertPosition.z;
+	RimStart = ConeRadius < maxRadius ? 1.0f - 2.0f * pixelSize / ConeRadius : 2.0f;
+
+	// depth is the distance to the site, normalized by the largest cone
+	gl_Position = projection * vec4(VertPosition.xy * ConeRadius + ConePosition, VertPosition.z * ConeRadius / maxRadius, 1.0f);
 })";
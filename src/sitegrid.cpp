@@ -0,0 +1,137 @@
+#include "sitegrid.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+SiteGrid::SiteGrid(const QVector<QVector2D>& points, int32_t width,
+                   int32_t height) {
+  // roughly one site per bucket
+  const float area = static_cast<float>(width) * height;
+  m_cellSize = std::max(1.0f, std::sqrt(area / std::max(1, points.size())));
+  m_columns = std::max(1, static_cast<int32_t>(std::ceil(width / m_cellSize)));
+  m_rows = std::max(1, static_cast<int32_t>(std::ceil(height / m_cellSize)));
+
+  QVector<int32_t> buckets(points.size());
+  m_bucketStart = QVector<int32_t>(m_columns * m_rows + 1, 0);
+  for (int i = 0; i < points.size(); ++i) {
+    const float x = points[i].x() * width;
+    const float y = points[i].y() * height;
+    buckets[i] = bucketY(y) * m_columns + bucketX(x);
+    ++m_bucketStart[buckets[i] + 1];
+  }
+  for (int b = 0; b < m_columns * m_rows; ++b) {
+    m_bucketStart[b + 1] += m_bucketStart[b];
+  }
+
+  // counting sort, stable in the site index
+  QVector<int32_t> fill = m_bucketStart;
+  m_sites = QVector<Site>(points.size());
+  m_slots = QVector<int32_t>(points.size());
+  for (int i = 0; i < points.size(); ++i) {
+    m_slots[i] = fill[buckets[i]]++;
+    m_sites[m_slots[i]] = {points[i].x() * width, points[i].y() * height,
+                           static_cast<uint32_t>(i)};
+  }
+}
+
+int32_t SiteGrid::bucketX(float x) const {
+  return std::max(0, std::min(static_cast<int32_t>(x / m_cellSize),
+                              m_columns - 1));
+}
+
+int32_t SiteGrid::bucketY(float y) const {
+  return std::max(0, std::min(static_cast<int32_t>(y / m_cellSize),
+                              m_rows - 1));
+}
+
+template <class Visit, class Done>
+void SiteGrid::search(float x, float y, Visit visit, Done done) const {
+  const int32_t bx = bucketX(x);
+  const int32_t by = bucketY(y);
+
+  auto visitBucket = [&](int32_t cx, int32_t cy) {
+    if (cx < 0 || cy < 0 || cx >= m_columns || cy >= m_rows) return;
+    const int32_t b = cy * m_columns + cx;
+    for (int32_t s = m_bucketStart[b]; s < m_bucketStart[b + 1]; ++s) {
+      visit(m_sites[s]);
+    }
+  };
+
+  const int32_t maxRing = std::max(m_columns, m_rows);
+  for (int32_t r = 0; r <= maxRing; ++r) {
+    if (r == 0) {
+      visitBucket(bx, by);
+    } else {
+      for (int32_t cx = bx - r; cx <= bx + r; ++cx) {
+        visitBucket(cx, by - r);
+        visitBucket(cx, by + r);
+      }
+      for (int32_t cy = by - r + 1; cy <= by + r - 1; ++cy) {
+        visitBucket(bx - r, cy);
+        visitBucket(bx + r, cy);
+      }
+    }
+    // every bucket beyond ring r is at least r buckets away
+    if (done(r * m_cellSize)) break;
+  }
+}
+
+uint32_t SiteGrid::nearest(int32_t x, int32_t y) const {
+  float distance2;
+  return nearest(x, y, distance2);
+}
+
+uint32_t SiteGrid::nearest(int32_t x, int32_t y, float& distance2) const {
+  const float px = x + 0.5f;
+  const float py = y + 0.5f;
+
+  float best = std::numeric_limits<float>::max();
+  uint32_t bestIndex = std::numeric_limits<uint32_t>::max();
+
+  search(px, py,
+         [&](const Site& site) {
+           const float dx = site.x - px;
+           const float dy = site.y - py;
+           const float d = dx * dx + dy * dy;
+           if (d < best || (d == best && site.index < bestIndex)) {
+             best = d;
+             bestIndex = site.index;
+           }
+         },
+         [&](float reach) { return best < reach * reach; });
+  distance2 = best;
+  return bestIndex;
+}
+
+float SiteGrid::neighborDistance(uint32_t site, int32_t k) const {
+  const Site& center = m_sites[m_slots[site]];
+
+  // k smallest squared distances, sorted ascending
+  std::vector<float> nearest;
+  nearest.reserve(k + 1);
+
+  search(center.x, center.y,
+         [&](const Site& s) {
+           if (s.index == center.index) return;
+           const float dx = s.x - center.x;
+           const float dy = s.y - center.y;
+           const float d = dx * dx + dy * dy;
+           if (static_cast<int32_t>(nearest.size()) == k &&
+               d >= nearest.back()) {
+             return;
+           }
+           nearest.insert(std::upper_bound(nearest.begin(), nearest.end(), d),
+                          d);
+           if (static_cast<int32_t>(nearest.size()) > k) nearest.pop_back();
+         },
+         [&](float reach) {
+           return static_cast<int32_t>(nearest.size()) == k &&
+                  nearest.back() < reach * reach;
+         });
+
+  if (static_cast<int32_t>(nearest.size()) < k) {
+    return std::numeric_limits<float>::infinity();
+  }
+  return std::sqrt(nearest.back());
+}
@@ -0,0 +1,47 @@
+#ifndef SITEGRID_H
+#define SITEGRID_H
+
+#include <QVector2D>
+#include <QVector>
+
+// Uniform bucket grid over the sites of a Voronoi diagram, in pixel units.
+// Sites are stored bucket by bucket in ascending index order, so ties are
+// resolved towards the lowest index just like the depth test of the cones.
+class SiteGrid {
+ public:
+  SiteGrid(const QVector<QVector2D>& points, int32_t width, int32_t height);
+
+  // Index of the site closest to the pixel center (x + 0.5, y + 0.5).
+  uint32_t nearest(int32_t x, int32_t y) const;
+  // Same, also returning the squared distance to that site.
+  uint32_t nearest(int32_t x, int32_t y, float& distance2) const;
+
+  // Distance in pixels from the given site to its k-th nearest other site,
+  // or infinity if there are not enough sites.
+  float neighborDistance(uint32_t site, int32_t k) const;
+
+ private:
+  struct Site {
+    float x;
+    float y;
+    uint32_t index;
+  };
+
+  float m_cellSize;
+  int32_t m_columns;
+  int32_t m_rows;
+  QVector<int32_t> m_bucketStart;
+  QVector<Site> m_sites;
+  QVector<int32_t> m_slots;
+
+  int32_t bucketX(float x) const;
+  int32_t bucketY(float y) const;
+
+  // Visits the buckets in growing rings around (x, y) until done(reach)
+  // returns true, where reach is a lower bound for the distance of every
+  // site that has not been visited yet.
+  template <class Visit, class Done>
+  void search(float x, float y, Visit visit, Done done) const;
+};
+
+#endif  // SITEGRID_H
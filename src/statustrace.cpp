@@ -0,0 +1,90 @@
+#include "statustrace.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+
+namespace {
+QJsonObject timings(const LBGStippling::Timings &t) {
+  return {{"density", t.density},       {"raster", t.raster},
+          {"readback", t.readback},     {"accumulate", t.accumulate},
+          {"splitMerge", t.splitMerge}};
+}
+
+QJsonObject event(const QString &name, const QString &phase, double time) {
+  return {{"name", name}, {"ph", phase}, {"ts", time}, {"pid", 1}, {"tid", 1}};
+}
+}  // namespace
+
+StatusTrace::StatusTrace(const QString &path, Format format)
+    : m_file(path), m_format(format), m_time(0.0), m_empty(true) {
+  if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return;
+  if (m_format == Format::ChromeTrace) m_file.write("[\n");
+}
+
+StatusTrace::~StatusTrace() {
+  if (isOpen() && m_format == Format::ChromeTrace) m_file.write("\n]\n");
+}
+
+void StatusTrace::write(const LBGStippling::Status &status) {
+  if (!isOpen()) return;
+
+  const QJsonObject counts = {{"size", qint64(status.size)},
+                              {"splits", qint64(status.splits)},
+                              {"merges", qint64(status.merges)},
+                              {"hysteresis", status.hysteresis},
+                              {"converged", status.converged}};
+
+  if (m_format == Format::JsonLines) {
+    QJsonObject line = counts;
+    line["iteration"] = qint64(status.iteration);
+    line["timings"] = timings(status.timings);
+    line["bytesAllocated"] = qint64(status.bytesAllocated);
+    line["pixels"] = qint64(status.pixels);
+    line["residual"] = status.residual;
+    writeObject(line);
+    return;
+  }
+
+  // complete events in microseconds, nested in one event per iteration
+  const LBGStippling::Timings &t = status.timings;
+  const std::pair<const char *, double> phases[] = {
+      {"density", t.density},       {"raster", t.raster},
+      {"readback", t.readback},     {"accumulate", t.accumulate},
+      {"splitMerge", t.splitMerge}};
+
+  double total = 0.0;
+  for (const auto &phase : phases) total += 1000.0 * phase.second;
+
+  QJsonObject iteration = event(
+      QString("iteration %1").arg(status.iteration), "X", m_time);
+  iteration["dur"] = total;
+  iteration["args"] = counts;
+  writeObject(iteration);
+
+  for (const auto &phase : phases) {
+    if (phase.second <= 0.0) continue;
+    QJsonObject e = event(phase.first, "X", m_time);
+    e["dur"] = 1000.0 * phase.second;
+    writeObject(e);
+    m_time += 1000.0 * phase.second;
+  }
+
+  const std::pair<const char *, double> counters[] = {
+      {"stipples", double(status.size)},
+      {"residual", status.residual},
+      {"bytesAllocated", double(status.bytesAllocated)},
+      {"pixels", double(status.pixels)}};
+  for (const auto &counter : counters) {
+    QJsonObject e = event(counter.first, "C", m_time);
+    e["args"] = QJsonObject{{counter.first, counter.second}};
+    writeObject(e);
+  }
+}
+
+void StatusTrace::writeObject(const QJsonObject &object) {
+  const QByteArray json = QJsonDocument(object).toJson(QJsonDocument::Compact);
+  if (m_format == Format::ChromeTrace && !m_empty) m_file.write(",\n");
+  m_file.write(json);
+  if (m_format == Format::JsonLines) m_file.write("\n");
+  m_empty = false;
+}
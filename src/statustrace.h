@@ -0,0 +1,39 @@
+#ifndef STATUSTRACE_H
+#define STATUSTRACE_H
+
+#include "lbgstippling.h"
+
+#include <QFile>
+#include <QString>
+
+class QJsonObject;
+
+// Writes the status of every iteration to a file, either in the Chrome trace
+// event format (chrome://tracing, Perfetto) or as one JSON object per line.
+// Trace timestamps lay the measured phases out back to back, so time spent
+// outside of them, e.g. in callbacks, is left out.
+class StatusTrace {
+ public:
+  enum class Format { ChromeTrace, JsonLines };
+
+  StatusTrace(const QString &path, Format format);
+  ~StatusTrace();
+
+  StatusTrace(const StatusTrace &) = delete;
+  StatusTrace &operator=(const StatusTrace &) = delete;
+
+  bool isOpen() const { return m_file.isOpen(); }
+
+  void write(const LBGStippling::Status &status);
+
+ private:
+  QFile m_file;
+  Format m_format;
+  // microseconds since the start of the trace
+  double m_time;
+  bool m_empty;
+
+  void writeObject(const QJsonObject &object);
+};
+
+#endif  // STATUSTRACE_H
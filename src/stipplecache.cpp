@@ -0,0 +1,134 @@
+#include "stipplecache.h"
+#include "stipplecheckpoint.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+
+#include <cmath>
+#include <limits>
+
+using Params = LBGStippling::Params;
+using Checkpoint = LBGStippling::Checkpoint;
+
+StippleCache::StippleCache(const QString &directory, size_t memoryEntries)
+    : m_directory(directory), m_memoryEntries(memoryEntries) {}
+
+StippleCache::Key StippleCache::key(const GrayView &density,
+                                    const Params &params) {
+  QCryptographicHash pixels(QCryptographicHash::Sha1);
+  const int32_t size[] = {density.width, density.height};
+  pixels.addData(reinterpret_cast<const char *>(size), sizeof(size));
+  for (int32_t y = 0; y < density.height; ++y) {
+    pixels.addData(reinterpret_cast<const char *>(density.constScanLine(y)),
+                   density.width);
+  }
+  const QByteArray densityHash = pixels.result();
+
+  auto hash = [&densityHash](const Params &p) {
+    QCryptographicHash h(QCryptographicHash::Sha1);
+    h.addData(densityHash);
+    h.addData(serializeParams(p));
+    return h.result().toHex();
+  };
+
+  // reporting and the way cells are accumulated do not change the result
+  Params exact = params;
+  exact.reportInterval = 0;
+  exact.reportIntervalMs = 0;
+  exact.checkpointInterval = 0;
+  exact.fusedAccumulation = true;
+  Params warm = exact;
+  warm.maxIterations = 0;
+  warm.hysteresis = 0.0f;
+  warm.hysteresisDelta = 0.0f;
+  return {hash(exact), hash(warm)};
+}
+
+bool StippleCache::find(const Key &key, Checkpoint &result) const {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+      if (it->key.exact != key.exact) continue;
+      m_entries.splice(m_entries.begin(), m_entries, it);
+      result = m_entries.front().result;
+      return true;
+    }
+  }
+
+  if (m_directory.isEmpty() || !loadCheckpoint(path(key), result)) {
+    return false;
+  }
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_entries.push_front({key, result});
+  if (m_entries.size() > m_memoryEntries) m_entries.pop_back();
+  return true;
+}
+
+bool StippleCache::findWarmStart(const Key &key, const Params &params,
+                                 Checkpoint &start) const {
+  // The candidate whose hysteresis is closest to that of the params at its
+  // iteration, later ones win ties.
+  float bestDistance = std::numeric_limits<float>::infinity();
+  size_t bestIteration = 0;
+  bool found = false;
+  auto better = [&](const Checkpoint &c) {
+    if (c.iteration > params.maxIterations) return false;
+    const float hysteresis =
+        params.hysteresis + c.iteration * params.hysteresisDelta;
+    const float distance = std::abs(hysteresis - c.hysteresis);
+    if (found && !(distance < bestDistance ||
+                   (distance == bestDistance && c.iteration > bestIteration))) {
+      return false;
+    }
+    bestDistance = distance;
+    bestIteration = c.iteration;
+    found = true;
+    return true;
+  };
+
+  if (m_directory.isEmpty()) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Checkpoint *best = nullptr;
+    for (const Entry &entry : m_entries) {
+      if (entry.key.warm == key.warm && better(entry.result)) {
+        best = &entry.result;
+      }
+    }
+    if (best) start = *best;
+    return best != nullptr;
+  }
+
+  // The directory holds all entries. Only their headers are read to choose
+  // one, the stipples only of that one.
+  const QDir directory(m_directory);
+  const QStringList files = directory.entryList(
+      {QString::fromLatin1(key.warm) + "-*.lbgs"}, QDir::Files);
+  QString best;
+  for (const QString &file : files) {
+    Checkpoint header;
+    if (loadCheckpointHeader(directory.filePath(file), header) &&
+        better(header)) {
+      best = directory.filePath(file);
+    }
+  }
+  return !best.isEmpty() && loadCheckpoint(best, start);
+}
+
+void StippleCache::insert(const Key &key, const Checkpoint &result) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.remove_if(
+        [&key](const Entry &entry) { return entry.key.exact == key.exact; });
+    m_entries.push_front({key, result});
+    if (m_entries.size() > m_memoryEntries) m_entries.pop_back();
+  }
+
+  if (!m_directory.isEmpty() && QDir().mkpath(m_directory)) {
+    saveCheckpoint(path(key), result);
+  }
+}
+
+QString StippleCache::path(const Key &key) const {
+  return QDir(m_directory)
+      .filePath(QString::fromLatin1(key.warm + "-" + key.exact) + ".lbgs");
+}
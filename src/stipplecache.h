@@ -0,0 +1,56 @@
+#ifndef STIPPLECACHE_H
+#define STIPPLECACHE_H
+
+#include "lbgstippling.h"
+
+#include <QByteArray>
+#include <QString>
+
+#include <list>
+#include <mutex>
+
+// Finished stipplings by a hash of the density pixels and the params that
+// affect the result. The latest results are kept in memory and, if a
+// directory is given, all of them on disk in the checkpoint format. Runs
+// that only differ in maxIterations or the hysteresis can continue from a
+// cached result of another one. Safe to share between threads.
+class StippleCache {
+ public:
+  struct Key {
+    // all params that affect the result
+    QByteArray exact;
+    // all but maxIterations and the hysteresis
+    QByteArray warm;
+  };
+
+  explicit StippleCache(const QString &directory = QString(),
+                        size_t memoryEntries = 8);
+
+  static Key key(const GrayView &density, const LBGStippling::Params &params);
+
+  bool find(const Key &key, LBGStippling::Checkpoint &result) const;
+
+  // The cached result of a compatible run with the hysteresis closest to
+  // that of the given params at the same iteration, among those that did
+  // not run longer than allowed by them.
+  bool findWarmStart(const Key &key, const LBGStippling::Params &params,
+                     LBGStippling::Checkpoint &start) const;
+
+  void insert(const Key &key, const LBGStippling::Checkpoint &result);
+
+ private:
+  struct Entry {
+    Key key;
+    LBGStippling::Checkpoint result;
+  };
+
+  QString m_directory;
+  size_t m_memoryEntries;
+  mutable std::mutex m_mutex;
+  // most recently used first
+  mutable std::list<Entry> m_entries;
+
+  QString path(const Key &key) const;
+};
+
+#endif  // STIPPLECACHE_H
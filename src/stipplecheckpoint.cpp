@@ -0,0 +1,156 @@
+#include "stipplecheckpoint.h"
+
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+
+namespace {
+
+using Params = LBGStippling::Params;
+using Backend = VoronoiDiagram::Backend;
+
+const quint32 magic = 0x5347424c;  // "LBGS"
+const quint32 version = 3;
+// x, y and size
+const qint64 bytesPerStipple = 3 * sizeof(float);
+
+void setUp(QDataStream &stream) {
+  stream.setVersion(QDataStream::Qt_5_0);
+  stream.setByteOrder(QDataStream::LittleEndian);
+  stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+}
+
+// Visits the params in file order, so that reading and writing agree.
+template <class Field>
+void visitParams(Params &p, Field field) {
+  field(p.initialPoints);
+  field(p.initialPointSize);
+  field(p.densityInitialization);
+  field(p.adaptivePointSize);
+  field(p.pointSizeMin);
+  field(p.pointSizeMax);
+  field(p.superSamplingFactor);
+  field(p.maxIterations);
+  field(p.hysteresis);
+  field(p.hysteresisDelta);
+  field(p.pyramidLevels);
+  field(p.levelUpRate);
+  field(p.reportInterval);
+  field(p.reportIntervalMs);
+  field(p.timeBudgetMs);
+  field(p.checkpointInterval);
+  field(p.seed);
+  field(p.voronoiBackend);
+  field(p.fusedAccumulation);
+}
+
+void write(QDataStream &out, size_t value) { out << quint64(value); }
+void write(QDataStream &out, uint32_t value) { out << quint32(value); }
+void write(QDataStream &out, float value) { out << value; }
+void write(QDataStream &out, bool value) { out << quint8(value); }
+void write(QDataStream &out, Backend value) { out << quint8(value); }
+
+void read(QDataStream &in, size_t &value) {
+  quint64 v;
+  in >> v;
+  value = v;
+}
+void read(QDataStream &in, uint32_t &value) {
+  quint32 v;
+  in >> v;
+  value = v;
+}
+void read(QDataStream &in, float &value) { in >> value; }
+void read(QDataStream &in, bool &value) {
+  quint8 v;
+  in >> v;
+  value = v != 0;
+}
+void read(QDataStream &in, Backend &value) {
+  quint8 v;
+  in >> v;
+  value = v == quint8(Backend::CPU) ? Backend::CPU : Backend::OpenGL;
+}
+
+// Reads up to the stipples, count receives their number.
+bool readHeader(QFile &file, LBGStippling::Checkpoint &checkpoint,
+                quint64 &count) {
+  QDataStream in(&file);
+  setUp(in);
+  quint32 fileMagic, fileVersion;
+  in >> fileMagic >> fileVersion;
+  if (fileMagic != magic || fileVersion != version) return false;
+
+  visitParams(checkpoint.params, [&in](auto &field) { read(in, field); });
+  quint64 iteration, level;
+  quint8 converged;
+  in >> iteration >> level >> checkpoint.hysteresis >> converged >> count;
+  checkpoint.iteration = iteration;
+  checkpoint.level = level;
+  checkpoint.converged = converged != 0;
+  return in.status() == QDataStream::Ok;
+}
+
+}  // namespace
+
+bool saveCheckpoint(const QString &path,
+                    const LBGStippling::Checkpoint &checkpoint) {
+  QSaveFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) return false;
+
+  QDataStream out(&file);
+  setUp(out);
+  out << magic << version;
+  Params params = checkpoint.params;
+  visitParams(params, [&out](auto &field) { write(out, field); });
+  out << quint64(checkpoint.iteration) << quint64(checkpoint.level)
+      << checkpoint.hysteresis << quint8(checkpoint.converged)
+      << quint64(checkpoint.stipples.size());
+  for (const Stipple &s : checkpoint.stipples) {
+    out << s.pos.x() << s.pos.y() << s.size;
+  }
+  return out.status() == QDataStream::Ok && file.commit();
+}
+
+bool loadCheckpoint(const QString &path, LBGStippling::Checkpoint &checkpoint) {
+  QFile file(path);
+  quint64 count;
+  if (!file.open(QIODevice::ReadOnly) || !readHeader(file, checkpoint, count)) {
+    return false;
+  }
+  // a broken count must not allocate more than the file holds
+  if (count > quint64(file.size() - file.pos()) / bytesPerStipple) {
+    return false;
+  }
+
+  QDataStream in(&file);
+  setUp(in);
+  checkpoint.stipples.resize(count);
+  for (Stipple &s : checkpoint.stipples) {
+    float x, y;
+    in >> x >> y >> s.size;
+    s.pos = QVector2D(x, y);
+    s.color = Qt::black;
+  }
+  return in.status() == QDataStream::Ok;
+}
+
+bool loadCheckpointHeader(const QString &path,
+                          LBGStippling::Checkpoint &checkpoint) {
+  QFile file(path);
+  quint64 count;
+  if (!file.open(QIODevice::ReadOnly) || !readHeader(file, checkpoint, count)) {
+    return false;
+  }
+  checkpoint.stipples.clear();
+  return true;
+}
+
+QByteArray serializeParams(const LBGStippling::Params &params) {
+  QByteArray bytes;
+  QDataStream out(&bytes, QIODevice::WriteOnly);
+  setUp(out);
+  Params copy = params;
+  visitParams(copy, [&out](auto &field) { write(out, field); });
+  return bytes;
+}
@@ -0,0 +1,27 @@
+#ifndef STIPPLECHECKPOINT_H
+#define STIPPLECHECKPOINT_H
+
+#include "lbgstippling.h"
+
+#include <QByteArray>
+#include <QString>
+
+// Compact binary stipple files: a header with the params, the iteration, the
+// hysteresis and whether the run converged, followed by the normalized position and the size of every
+// stipple as packed little-endian floats. Colors are not stored.
+
+// Replaces the file only once it is completely written, so an interrupted
+// run keeps its previous checkpoint.
+bool saveCheckpoint(const QString &path,
+                    const LBGStippling::Checkpoint &checkpoint);
+
+bool loadCheckpoint(const QString &path, LBGStippling::Checkpoint &checkpoint);
+
+// Reads all but the stipples, which are left empty.
+bool loadCheckpointHeader(const QString &path,
+                          LBGStippling::Checkpoint &checkpoint);
+
+// The params as stored in the header, e.g. to compare or hash them.
+QByteArray serializeParams(const LBGStippling::Params &params);
+
+#endif  // STIPPLECHECKPOINT_H
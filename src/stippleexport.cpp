@@ -0,0 +1,76 @@
+#include "stippleexport.h"
+
+#include <QFile>
+#include <QPainter>
+#include <QTextStream>
+
+namespace {
+QPointF position(const Stipple &s, const QSize &size) {
+  return QPointF(s.pos.x() * size.width(), s.pos.y() * size.height());
+}
+
+// The default of six significant digits rounds the coordinates of large
+// images to whole pixels, a thousandth of a pixel is kept instead.
+void setUp(QTextStream &out) {
+  out.setRealNumberNotation(QTextStream::FixedNotation);
+  out.setRealNumberPrecision(3);
+}
+}  // namespace
+
+bool saveStipplesSVG(const QString &path, const std::vector<Stipple> &stipples,
+                     const QSize &size) {
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+  QTextStream out(&file);
+  setUp(out);
+  out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+      << "<svg xmlns=\"http://www.w3.org/2000/svg\" version=\"1.1\" width=\""
+      << size.width() << "\" height=\"" << size.height() << "\" viewBox=\"0 0 "
+      << size.width() << " " << size.height() << "\">\n"
+      << "<title>Stippling Result</title>\n"
+      << "<desc>SVG File created by Weighted Linde-Buzo-Gray Stippling"
+      << "</desc>\n";
+  for (const auto &s : stipples) {
+    const QPointF p = position(s, size);
+    out << "<circle cx=\"" << p.x() << "\" cy=\"" << p.y() << "\" r=\""
+        << s.size / 2.0f << "\" fill=\"" << s.color.name() << "\"/>\n";
+  }
+  out << "</svg>\n";
+  out.flush();
+  return out.status() == QTextStream::Ok;
+}
+
+bool saveStipplesPNG(const QString &path, const std::vector<Stipple> &stipples,
+                     const QSize &size) {
+  QImage image(size, QImage::Format_RGB32);
+  image.fill(Qt::white);
+
+  QPainter painter(&image);
+  painter.setRenderHint(QPainter::Antialiasing, true);
+  painter.setPen(Qt::NoPen);
+  for (const auto &s : stipples) {
+    const qreal radius = s.size / 2.0f;
+    painter.setBrush(s.color);
+    painter.drawEllipse(position(s, size), radius, radius);
+  }
+  painter.end();
+
+  return image.save(path, "PNG");
+}
+
+bool saveStipplesText(const QString &path,
+                      const std::vector<Stipple> &stipples, const QSize &size) {
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) return false;
+
+  QTextStream out(&file);
+  setUp(out);
+  out << "# x y size\n";
+  for (const auto &s : stipples) {
+    const QPointF p = position(s, size);
+    out << p.x() << " " << p.y() << " " << s.size << "\n";
+  }
+  out.flush();
+  return out.status() == QTextStream::Ok;
+}
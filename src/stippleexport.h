@@ -0,0 +1,23 @@
+#ifndef STIPPLEEXPORT_H
+#define STIPPLEEXPORT_H
+
+#include "lbgstippling.h"
+
+#include <QSize>
+#include <QString>
+
+// Writers for finished stipplings that only depend on QtGui. Stipple
+// positions are scaled to the given image size, sizes are in pixels.
+
+bool saveStipplesSVG(const QString &path, const std::vector<Stipple> &stipples,
+                     const QSize &size);
+
+// Rasterizes the stipples on a white background.
+bool saveStipplesPNG(const QString &path, const std::vector<Stipple> &stipples,
+                     const QSize &size);
+
+// One "x y size" line per stipple.
+bool saveStipplesText(const QString &path,
+                      const std::vector<Stipple> &stipples, const QSize &size);
+
+#endif  // STIPPLEEXPORT_H
@@ -0,0 +1,105 @@
+#include "stippleitem.h"
+
+#include <QPaintEngine>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+#include <QWidget>
+
+namespace {
+// longest side of the cached raster in pixels
+const int maxCacheSize = 8192;
+// stipples smaller than this many device pixels are drawn as points
+const qreal minEllipseSize = 1.5;
+
+bool isScreen(QPainter *painter, QWidget *widget) {
+  if (!widget) return false;
+  const QPaintEngine::Type type = painter->paintEngine()->type();
+  return type == QPaintEngine::Raster || type == QPaintEngine::OpenGL2;
+}
+}  // namespace
+
+StippleItem::StippleItem(QGraphicsItem *parent)
+    : QGraphicsItem(parent), m_cacheScale(0.0), m_cacheValid(false) {}
+
+void StippleItem::setStipples(std::vector<Stipple> stipples,
+                              const QSize &size) {
+  if (size != m_size) {
+    prepareGeometryChange();
+    m_size = size;
+  }
+  m_stipples = std::move(stipples);
+  m_cacheValid = false;
+  update();
+}
+
+void StippleItem::clear() { setStipples({}, m_size); }
+
+QRectF StippleItem::boundingRect() const { return QRectF(QPointF(), m_size); }
+
+void StippleItem::paint(QPainter *painter,
+                        const QStyleOptionGraphicsItem *option,
+                        QWidget *widget) {
+  if (m_stipples.empty() || m_size.isEmpty()) return;
+
+  if (!isScreen(painter, widget)) {
+    drawStipples(painter, 0.0);
+    return;
+  }
+
+  // rasterize at the resolution the item currently covers on screen
+  const qreal lod =
+      option->levelOfDetailFromTransform(painter->worldTransform()) *
+      widget->devicePixelRatioF();
+  const qreal scale = std::min(
+      lod, qreal(maxCacheSize) / std::max(m_size.width(), m_size.height()));
+
+  if (!m_cacheValid || scale != m_cacheScale) {
+    m_cache = QImage((QSizeF(m_size) * scale).toSize().expandedTo(QSize(1, 1)),
+                     QImage::Format_ARGB32_Premultiplied);
+    m_cache.fill(Qt::transparent);
+
+    QPainter cachePainter(&m_cache);
+    cachePainter.setRenderHint(QPainter::Antialiasing, true);
+    cachePainter.scale(qreal(m_cache.width()) / m_size.width(),
+                       qreal(m_cache.height()) / m_size.height());
+    drawStipples(&cachePainter, scale);
+
+    m_cacheScale = scale;
+    m_cacheValid = true;
+  }
+
+  painter->setRenderHint(QPainter::SmoothPixmapTransform, true);
+  painter->drawImage(boundingRect(), m_cache);
+}
+
+// A device scale of zero always draws the exact circles.
+
+void StippleItem::drawStipples(QPainter *painter, qreal deviceScale) const {
+  painter->setPen(Qt::NoPen);
+
+  QVector<QPointF> points;
+  QColor pointColor;
+  auto flushPoints = [&]() {
+    if (points.isEmpty()) return;
+    painter->setPen(QPen(pointColor, 0.0));
+    painter->drawPoints(points.constData(), points.size());
+    painter->setPen(Qt::NoPen);
+    points.clear();
+  };
+
+  for (const auto &s : m_stipples) {
+    const QPointF center(s.pos.x() * m_size.width(),
+                         s.pos.y() * m_size.height());
+    if (deviceScale > 0.0 && s.size * deviceScale < minEllipseSize) {
+      // consecutive points of the same color are drawn in one call
+      if (s.color != pointColor) flushPoints();
+      pointColor = s.color;
+      points.push_back(center);
+      continue;
+    }
+    const qreal radius = s.size / 2.0f;
+    painter->setBrush(s.color);
+    painter->drawEllipse(center, radius, radius);
+  }
+  flushPoints();
+}
@@ -0,0 +1,35 @@
+#ifndef STIPPLEITEM_H
+#define STIPPLEITEM_H
+
+#include <QGraphicsItem>
+#include <QImage>
+
+#include "lbgstippling.h"
+
+// Draws all stipples of a run as one item from a flat array. On screen the
+// stipples are rasterized once per update and zoom level into a cached
+// image, at a lower resolution and as plain points when zoomed out. Other
+// devices like SVG, PDF or exported pixmaps get the exact circles.
+class StippleItem : public QGraphicsItem {
+ public:
+  explicit StippleItem(QGraphicsItem *parent = nullptr);
+
+  // Positions are relative and scaled to the given size.
+  void setStipples(std::vector<Stipple> stipples, const QSize &size);
+  void clear();
+
+  QRectF boundingRect() const override;
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
+             QWidget *widget) override;
+
+ private:
+  std::vector<Stipple> m_stipples;
+  QSize m_size;
+  QImage m_cache;
+  qreal m_cacheScale;
+  bool m_cacheValid;
+
+  void drawStipples(QPainter *painter, qreal deviceScale) const;
+};
+
+#endif  // STIPPLEITEM_H
@@ -1,11 +1,21 @@
 #include "stippleviewer.h"
+#include "stippleitem.h"
 
-#include <QCoreApplication>
+#include <QGraphicsPixmapItem>
+#include <QGuiApplication>
 #include <QPrinter>
+#include <QScreen>
 #include <QSvgGenerator>
 
 StippleViewer::StippleViewer(const QImage &img, QWidget *parent)
-    : QGraphicsView(parent), m_image(img) {
+    : QGraphicsView(parent),
+      m_image(img),
+      m_hasPending(false),
+      m_worker(new QObject()),
+      m_running(false),
+      m_cancel(false) {
+  qRegisterMetaType<size_t>("size_t");
+
   setInteractive(false);
   setRenderHint(QPainter::Antialiasing, true);
   setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
@@ -17,29 +27,64 @@ StippleViewer::StippleViewer(const QImage &img, QWidget *parent)
   setScene(new QGraphicsScene(this));
   this->scene()->setSceneRect(m_image.rect());
   this->scene()->setItemIndexMethod(QGraphicsScene::NoIndex);
-  this->scene()->addPixmap(QPixmap::fromImage(m_image));
+  m_imageItem = this->scene()->addPixmap(QPixmap::fromImage(m_image));
+  m_stippleItem = new StippleItem();
+  this->scene()->addItem(m_stippleItem);
+
+  const QScreen *screen = QGuiApplication::primaryScreen();
+  const qreal refreshRate = screen ? screen->refreshRate() : 60.0;
+  m_frameTimer.setInterval(static_cast<int>(1000.0 / refreshRate));
+  connect(&m_frameTimer, &QTimer::timeout, this, &StippleViewer::showPending);
 
+  // The callbacks run on the worker thread, the status signal is queued to
+  // the receivers on the GUI thread.
   m_stippling = LBGStippling();
   m_stippling.setStatusCallback([this](const auto &status) {
     emit iterationStatus(status.iteration + 1, status.size, status.splits,
                          status.merges, status.hysteresis);
   });
 
-  m_stippling.setStippleCallback(
-      [this](const auto &stipples) { displayPoints(stipples); });
+  m_stippling.setDeltaCallback([this](const StippleDelta &delta) {
+    QMutexLocker lock(&m_pendingMutex);
+    delta.apply(m_pending);
+    m_hasPending = true;
+  });
+  m_stippling.setCancelFlag(&m_cancel);
+  // the worker thread cannot create the OpenGL surface itself
+  m_stippling.prepareOpenGL();
+
+  m_worker->moveToThread(&m_thread);
+  connect(&m_thread, &QThread::finished, m_worker, &QObject::deleteLater);
+  m_thread.start();
+}
+
+StippleViewer::~StippleViewer() {
+  cancel();
+  // Waits for a running stippling to see the cancel flag, the pooled OpenGL
+  // objects have to be freed on the thread that created them. The worker
+  // never waits for the GUI thread, so this cannot deadlock.
+  QMetaObject::invokeMethod(
+      m_worker, [this]() { m_stippling.releaseResources(); },
+      Qt::BlockingQueuedConnection);
+  m_thread.quit();
+  m_thread.wait();
 }
 
 void StippleViewer::displayPoints(const std::vector<Stipple> &stipples) {
-  this->scene()->clear();
-  for (const auto &s : stipples) {
-    double x = static_cast<double>(s.pos.x() * m_image.width() - s.size / 2.0f);
-    double y =
-        static_cast<double>(s.pos.y() * m_image.height() - s.size / 2.0f);
-    double size = static_cast<double>(s.size);
-    this->scene()->addEllipse(x, y, size, size, Qt::NoPen, s.color);
+  m_imageItem->hide();
+  m_stippleItem->setStipples(stipples, m_image.size());
+}
+
+void StippleViewer::showPending() {
+  std::vector<Stipple> stipples;
+  {
+    QMutexLocker lock(&m_pendingMutex);
+    if (!m_hasPending) return;
+    stipples = m_pending;
+    m_hasPending = false;
   }
-  // TODO: Fix event handling
-  QCoreApplication::processEvents();
+  m_imageItem->hide();
+  m_stippleItem->setStipples(std::move(stipples), m_image.size());
 }
 
 QPixmap StippleViewer::getImage() {
@@ -83,8 +128,9 @@ void StippleViewer::saveImagePDF(const QString &path) {
 
 void StippleViewer::setInputImage(const QImage &img) {
   m_image = img;
-  this->scene()->clear();
-  this->scene()->addPixmap(QPixmap::fromImage(m_image));
+  m_imageItem->setPixmap(QPixmap::fromImage(m_image));
+  m_imageItem->show();
+  m_stippleItem->clear();
   this->scene()->setSceneRect(m_image.rect());
 
   auto w = m_image.width();
@@ -96,7 +142,28 @@ void StippleViewer::setInputImage(const QImage &img) {
 }
 
 void StippleViewer::stipple(const LBGStippling::Params params) {
-  // TODO: Handle return value
-  m_stippling.stipple(m_image, params);
-  emit finished();
+  if (m_running) return;
+  m_running = true;
+  m_cancel = false;
+  {
+    // the first delta of a run lists every stipple
+    QMutexLocker lock(&m_pendingMutex);
+    m_pending.clear();
+    m_hasPending = false;
+  }
+  m_frameTimer.start();
+
+  // The last iteration is already pending from the stipple callback when
+  // the finished notification arrives.
+  QMetaObject::invokeMethod(m_worker, [this, params, image = m_image]() {
+    m_stippling.stipple(image, params);
+    QMetaObject::invokeMethod(this, [this]() {
+      m_frameTimer.stop();
+      showPending();
+      m_running = false;
+      emit finished();
+    });
+  });
 }
+
+void StippleViewer::cancel() { m_cancel = true; }
@@ -2,15 +2,26 @@
 #define STIPPLEVIEWER_H
 
 #include <QGraphicsView>
+#include <QMutex>
+#include <QThread>
+#include <QTimer>
+
+#include <atomic>
 
 #include "lbgstippling.h"
 
+class StippleItem;
+
 class StippleViewer : public QGraphicsView {
   Q_OBJECT
 
  public:
   StippleViewer(const QImage &img, QWidget *parent);
+  ~StippleViewer() override;
+  // Runs on a worker thread, progress arrives through queued signals.
   void stipple(const LBGStippling::Params params);
+  // Stops the running stippling after its current iteration.
+  void cancel();
   QPixmap getImage();
   void setInputImage(const QImage &img);
   void saveImageSVG(const QString &path);
@@ -26,6 +37,22 @@ class StippleViewer : public QGraphicsView {
  private:
   LBGStippling m_stippling;
   QImage m_image;
+  QGraphicsPixmapItem *m_imageItem;
+  StippleItem *m_stippleItem;
+
+  // The worker applies its deltas to a copy of the newest stipples, the
+  // frame timer shows that copy at most once per display refresh.
+  QTimer m_frameTimer;
+  QMutex m_pendingMutex;
+  std::vector<Stipple> m_pending;
+  bool m_hasPending;
+  // all runs share one thread, it owns the OpenGL context of the pool
+  QThread m_thread;
+  QObject *m_worker;
+  bool m_running;
+  std::atomic<bool> m_cancel;
+
+  void showPending();
 };
 
 #endif  // STIPPLEVIEWER_H
@@ -0,0 +1,30 @@
+#ifndef STOPWATCH_H
+#define STOPWATCH_H
+
+#include <chrono>
+
+// Wall-clock time since construction or the last restart, in milliseconds.
+class Stopwatch {
+ public:
+  Stopwatch() : m_start(Clock::now()) {}
+
+  double elapsed() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - m_start)
+        .count();
+  }
+
+  // Returns the elapsed time and starts over.
+  double restart() {
+    const Clock::time_point now = Clock::now();
+    const double ms =
+        std::chrono::duration<double, std::milli>(now - m_start).count();
+    m_start = now;
+    return ms;
+  }
+
+ private:
+  using Clock = std::chrono::steady_clock;
+  Clock::time_point m_start;
+};
+
+#endif  // STOPWATCH_H
@@ -0,0 +1,230 @@
+#include "tiledstippling.h"
+#include "cpuvoronoidiagram.h"
+#include "densityfield.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <random>
+
+namespace {
+
+// Gray values of a region, read from the source.
+struct Region {
+  QRect rect;
+  std::vector<uchar> pixels;
+
+  Region(const TiledStippling::RegionSource& source, const QRect& r)
+      : rect(r), pixels(size_t(r.width()) * r.height()) {
+    source(rect, pixels.data(), rect.width());
+  }
+
+  GrayView view() const {
+    return {pixels.data(), rect.width(), rect.height(), rect.width()};
+  }
+};
+
+// Stipple positions within a region are normalized to the region, those of
+// the whole image are kept in image pixels until the end.
+
+QVector2D toImage(const QVector2D& p, const QRect& region) {
+  return QVector2D(region.x() + p.x() * region.width(),
+                   region.y() + p.y() * region.height());
+}
+
+QVector2D toRegion(const QVector2D& p, const QRect& region) {
+  return QVector2D((p.x() - region.x()) / region.width(),
+                   (p.y() - region.y()) / region.height());
+}
+
+bool contains(const QRectF& rect, const QVector2D& p) {
+  return p.x() >= rect.left() && p.x() < rect.right() && p.y() >= rect.top() &&
+         p.y() < rect.bottom();
+}
+
+// Independent seeds for the tiles and seams of a run, 0 stays random.
+uint32_t deriveSeed(uint32_t seed, uint32_t index) {
+  if (seed == 0) return 0;
+  std::seed_seq seq{seed, index};
+  uint32_t derived;
+  seq.generate(&derived, &derived + 1);
+  return std::max(1u, derived);
+}
+
+struct Seam {
+  // density read for the seam
+  QRect window;
+  // stipples inside move, the others stay
+  QRectF band;
+};
+
+// Split and merge steps over the window of a seam. The cells of the stipples
+// outside the band are computed, so that the band sees its neighbors, but
+// those stipples are kept as they are.
+void relaxSeam(const Seam& seam, const TiledStippling::RegionSource& source,
+               const LBGStippling::Params& params, float hysteresis,
+               size_t iterations, uint32_t seed,
+               std::vector<Stipple>& stipples) {
+  if (stipples.empty() || iterations == 0) return;
+
+  const Region gray(source, seam.window);
+  const int32_t factor = params.superSamplingFactor;
+  const DensityField density(gray.view(), factor * seam.window.width(),
+                             factor * seam.window.height());
+  CPUVoronoiDiagram voronoi(density);
+  std::mt19937 random(seed != 0 ? seed : std::random_device{}());
+
+  LBGStippling::Status status = {};
+  status.hysteresis = hysteresis;
+  std::vector<Stipple> next;
+  std::vector<uint32_t> origin;
+  for (size_t i = 0; i < iterations; ++i) {
+    QVector<QVector2D> points(stipples.size());
+    std::vector<char> fixed(stipples.size());
+    for (size_t s = 0; s < stipples.size(); ++s) {
+      points[s] = toRegion(stipples[s].pos, seam.window);
+      fixed[s] = !contains(seam.band, stipples[s].pos);
+    }
+
+    const std::vector<VoronoiCell> cells =
+        voronoi.calculateCells(points, density);
+    LBGStippling::splitMerge(cells, density, float(factor), params, status,
+                             random, next, origin);
+
+    std::vector<Stipple> relaxed;
+    relaxed.reserve(next.size());
+    for (size_t s = 0; s < stipples.size(); ++s) {
+      if (fixed[s]) relaxed.push_back(stipples[s]);
+    }
+    for (size_t s = 0; s < next.size(); ++s) {
+      if (fixed[origin[s]]) continue;
+      relaxed.push_back(next[s]);
+      relaxed.back().pos = toImage(next[s].pos, seam.window);
+    }
+    stipples.swap(relaxed);
+    if (stipples.empty()) return;
+  }
+}
+
+}  // namespace
+
+TiledStippling::TiledStippling(const LBGStippling& stippling)
+    : m_stippling(stippling) {}
+
+std::vector<Stipple> TiledStippling::stipple(const QSize& size,
+                                             const RegionSource& source,
+                                             const Params& params) const {
+  assert(params.tileSize >= 4);
+  const QRect bounds(QPoint(0, 0), size);
+  const int32_t tileSize = params.tileSize;
+  // keeps the windows of seams relaxed at once apart
+  const int32_t halo = std::min(params.halo, tileSize / 4);
+  const int32_t tilesX = (size.width() + tileSize - 1) / tileSize;
+  const int32_t tilesY = (size.height() + tileSize - 1) / tileSize;
+
+  auto tileRect = [&](int32_t tx, int32_t ty) {
+    return QRect(tx * tileSize, ty * tileSize, tileSize, tileSize) & bounds;
+  };
+  auto tileOf = [&](const QVector2D& p) {
+    const int32_t tx = std::min(tilesX - 1, int32_t(p.x()) / tileSize);
+    const int32_t ty = std::min(tilesY - 1, int32_t(p.y()) / tileSize);
+    return ty * tilesX + tx;
+  };
+
+  // the OpenGL backend needs its context on one thread
+  const int jobs =
+      params.stippling.voronoiBackend == VoronoiDiagram::Backend::OpenGL
+          ? 1
+          : std::max(1, params.jobs);
+
+  // stipples in image pixels, by the tile that holds them
+  std::vector<std::vector<Stipple>> tiles(tilesX * tilesY);
+  std::vector<float> hysteresis(tiles.size(), params.stippling.hysteresis);
+
+  parallelForEach(tiles.size(), jobs, [&](int t) {
+    const QRect core = tileRect(t % tilesX, t / tilesX);
+    const Region gray(source, core.adjusted(-halo, -halo, halo, halo) & bounds);
+
+    LBGStippling::Params tileParams = params.stippling;
+    tileParams.seed = deriveSeed(params.stippling.seed, t);
+    std::vector<Stipple> stipples;
+    hysteresis[t] =
+        m_stippling.stipple(gray.view(), tileParams, stipples).hysteresis;
+
+    for (Stipple s : stipples) {
+      s.pos = toImage(s.pos, gray.rect);
+      if (contains(QRectF(core), s.pos)) tiles[t].push_back(s);
+    }
+  });
+  const float seamHysteresis =
+      *std::max_element(hysteresis.begin(), hysteresis.end());
+
+  // Vertical seams of even and of odd tile rows, then horizontal seams of
+  // even and of odd tile columns. The windows within each group are apart,
+  // so they are relaxed at once. Corners are relaxed twice.
+  std::vector<Seam> groups[4];
+  for (int32_t ty = 0; ty < tilesY; ++ty) {
+    for (int32_t tx = 1; tx < tilesX; ++tx) {
+      const QRect core = tileRect(tx, ty);
+      const QRectF band(core.x() - halo / 2.0, core.y(), halo, core.height());
+      const QRect window =
+          QRect(core.x() - halo, core.y() - halo, 2 * halo,
+                core.height() + 2 * halo) &
+          bounds;
+      groups[ty % 2].push_back({window, band});
+    }
+  }
+  for (int32_t tx = 0; tx < tilesX; ++tx) {
+    for (int32_t ty = 1; ty < tilesY; ++ty) {
+      const QRect core = tileRect(tx, ty);
+      const QRectF band(core.x(), core.y() - halo / 2.0, core.width(), halo);
+      const QRect window =
+          QRect(core.x() - halo, core.y() - halo, core.width() + 2 * halo,
+                2 * halo) &
+          bounds;
+      groups[2 + tx % 2].push_back({window, band});
+    }
+  }
+
+  for (int32_t g = 0; g < 4; ++g) {
+    const std::vector<Seam>& seams = groups[g];
+    // windows may share tiles, so the stipples are moved out and back here
+    std::vector<std::vector<Stipple>> local(seams.size());
+    for (size_t i = 0; i < seams.size(); ++i) {
+      const QRect& window = seams[i].window;
+      for (int32_t ty = window.top() / tileSize;
+           ty <= window.bottom() / tileSize; ++ty) {
+        for (int32_t tx = window.left() / tileSize;
+             tx <= window.right() / tileSize; ++tx) {
+          std::vector<Stipple>& tile = tiles[ty * tilesX + tx];
+          auto inside = std::stable_partition(
+              tile.begin(), tile.end(), [&](const Stipple& s) {
+                return !contains(QRectF(window), s.pos);
+              });
+          local[i].insert(local[i].end(), inside, tile.end());
+          tile.erase(inside, tile.end());
+        }
+      }
+    }
+
+    parallelForEach(seams.size(), jobs, [&](int i) {
+      const uint32_t seed =
+          deriveSeed(params.stippling.seed, tiles.size() + 4 * i + g);
+      relaxSeam(seams[i], source, params.stippling, seamHysteresis,
+                params.seamIterations, seed, local[i]);
+    });
+
+    for (const std::vector<Stipple>& stipples : local) {
+      for (const Stipple& s : stipples) tiles[tileOf(s.pos)].push_back(s);
+    }
+  }
+
+  std::vector<Stipple> result;
+  for (const std::vector<Stipple>& tile : tiles) {
+    for (Stipple s : tile) {
+      s.pos = QVector2D(s.pos.x() / size.width(), s.pos.y() / size.height());
+      result.push_back(s);
+    }
+  }
+  return result;
+}
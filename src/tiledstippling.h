@@ -0,0 +1,46 @@
+#ifndef TILEDSTIPPLING_H
+#define TILEDSTIPPLING_H
+
+#include "lbgstippling.h"
+
+#include <QRect>
+
+#include <functional>
+
+// Stipples densities too large to be processed at once. The image is cut into
+// tiles that are stippled independently, each with a halo of the density
+// around it, so that its cells see what lies beyond its border. Only the
+// stipples inside the tile itself are kept. The seams are then relaxed by a
+// few split and merge steps over a band around each seam, while the stipples
+// outside the band stay in place. Apart from the result, memory only grows
+// with the tile size and the number of jobs.
+class TiledStippling {
+ public:
+  struct Params {
+    LBGStippling::Params stippling;
+
+    // edge length of the tiles and width of their halos, in input pixels
+    int32_t tileSize = 4096;
+    int32_t halo = 128;
+    // split and merge steps per seam
+    size_t seamIterations = 8;
+    // tiles stippled at once, OpenGL tiles all run on the calling thread
+    int jobs = 2;
+  };
+
+  // Writes the gray values of a region of the image to pixels, whose rows
+  // are stride bytes apart. Called from several threads at once.
+  using RegionSource = std::function<void(const QRect& region, uchar* pixels,
+                                          int32_t stride)>;
+
+  explicit TiledStippling(const LBGStippling& stippling = LBGStippling());
+
+  // Positions are normalized to the whole image.
+  std::vector<Stipple> stipple(const QSize& size, const RegionSource& source,
+                               const Params& params) const;
+
+ private:
+  LBGStippling m_stippling;
+};
+
+#endif  // TILEDSTIPPLING_H
@@ -1,64 +1,103 @@
 #include "voronoicell.h"
+#include "densityfield.h"
+#include "parallel.h"
 #include "voronoidiagram.h"
 
+#include <cassert>
 #include <cmath>
 
-struct Moments {
-  float moment00;
-  float moment10;
-  float moment01;
-  float moment11;
-  float moment20;
-  float moment02;
-};
+void Moments::addSpan(const DensityField& density, int32_t y, int32_t begin,
+                      int32_t end) {
+  const DensityField::SpanSums sums = density.rowSums(y, begin, end);
+  area += end - begin;
+  moment00 += sums.sum0;
+  moment10 += sums.sum1;
+  moment01 += y * sums.sum0;
+  moment11 += y * sums.sum1;
+  moment20 += sums.sum2;
+  moment02 += double(y) * y * sums.sum0;
+}
 
-std::vector<VoronoiCell> accumulateCells(const IndexMap& map,
-                                         const QImage& density) {
-  // compute voronoi cell moments
-  std::vector<VoronoiCell> cells = std::vector<VoronoiCell>(map.count());
-  std::vector<Moments> moments = std::vector<Moments>(map.count());
+Moments& Moments::operator+=(const Moments& other) {
+  area += other.area;
+  moment00 += other.moment00;
+  moment10 += other.moment10;
+  moment01 += other.moment01;
+  moment11 += other.moment11;
+  moment20 += other.moment20;
+  moment02 += other.moment02;
+  return *this;
+}
 
-  for (int x = 0; x < map.width; ++x) {
-    for (int y = 0; y < map.height; ++y) {
-      uint32_t index = map.get(x, y);
+VoronoiCell cellFromMoments(const Moments& moments, int32_t width,
+                            int32_t height) {
+  VoronoiCell cell = {};
+  cell.area = static_cast<float>(moments.area);
+  cell.sumDensity = static_cast<float>(moments.moment00);
+  if (cell.sumDensity <= 0.0f) return cell;
 
-      QRgb densityPixel = density.pixel(x, y);
-      float density = std::max(1.0f - qGray(densityPixel) / 255.0f,
-                               std::numeric_limits<float>::epsilon());
+  const double m00 = moments.moment00;
 
-      VoronoiCell& cell = cells[index];
-      cell.area++;
-      cell.sumDensity += density;
+  // centroid
+  const double cx = moments.moment10 / m00;
+  const double cy = moments.moment01 / m00;
 
-      Moments& m = moments[index];
-      m.moment00 += density;
-      m.moment10 += x * density;
-      m.moment01 += y * density;
-      m.moment11 += x * y * density;
-      m.moment20 += x * x * density;
-      m.moment02 += y * y * density;
-    }
-  }
+  // orientation
+  const double x = moments.moment20 / m00 - cx * cx;
+  const double y = 2.0 * (moments.moment11 / m00 - cx * cy);
+  const double z = moments.moment02 / m00 - cy * cy;
+  cell.orientation = static_cast<float>(std::atan2(y, x - z) / 2.0);
 
-  // compute cell quantities
-  for (size_t i = 0; i < cells.size(); ++i) {
-    VoronoiCell& cell = cells[i];
-    if (cell.sumDensity <= 0.0f) continue;
+  cell.centroid.setX(static_cast<float>((cx + 0.5) / width));
+  cell.centroid.setY(static_cast<float>((cy + 0.5) / height));
+  return cell;
+}
 
-    auto [m00, m10, m01, m11, m20, m02] = moments[i];
+// upper bound for the memory of all per-thread moment arrays
+static const size_t maxPartialMomentBytes = 256 * 1024 * 1024;
 
-    // centroid
-    cell.centroid.setX(m10 / m00);
-    cell.centroid.setY(m01 / m00);
+std::vector<VoronoiCell> accumulateCells(const IndexMap& map,
+                                         const DensityField& density) {
+  assert(density.width() == map.width && density.height() == map.height);
+  const size_t count = map.count();
+  const int32_t width = density.width();
+  const int32_t height = density.height();
 
-    // orientation
-    float x = m20 / m00 - cell.centroid.x() * cell.centroid.x();
-    float y = 2.0f * (m11 / m00 - cell.centroid.x() * cell.centroid.y());
-    float z = m02 / m00 - cell.centroid.y() * cell.centroid.y();
-    cell.orientation = std::atan2(y, x - z) / 2.0f;
+  // Every thread walks a band of rows and sums into its own moments, which
+  // are reduced afterwards. Rows are split into runs of the same cell, whose
+  // moments come from the prefix sums of the density field in one step.
+  // Fewer bands are used when there are so many cells that the copies would
+  // not fit the memory budget.
+  const size_t bandBytes = std::max<size_t>(1, count) * sizeof(Moments);
+  const int maxBands = static_cast<int>(
+      std::max<size_t>(1, maxPartialMomentBytes / bandBytes));
+  const int bands = std::min(parallelChunks(height), maxBands);
 
-    cell.centroid.setX((cell.centroid.x() + 0.5f) / density.width());
-    cell.centroid.setY((cell.centroid.y() + 0.5f) / density.height());
-  }
+  std::vector<std::vector<Moments>> partial(bands);
+  parallelFor(bands, [&](int, int bandBegin, int bandEnd) {
+    for (int band = bandBegin; band < bandEnd; ++band) {
+      std::vector<Moments>& moments = partial[band];
+      moments.assign(count, Moments{});
+
+      const int yBegin = static_cast<int>(int64_t(height) * band / bands);
+      const int yEnd = static_cast<int>(int64_t(height) * (band + 1) / bands);
+      for (int y = yBegin; y < yEnd; ++y) {
+        forEachSpan(map.constScanLine(y), width,
+                    [&](int32_t begin, int32_t end, uint32_t index) {
+                      moments[index].addSpan(density, y, begin, end);
+                    });
+      }
+    }
+  });
+
+  std::vector<VoronoiCell> cells = std::vector<VoronoiCell>(count);
+
+  parallelFor(static_cast<int>(count), [&](int, int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      Moments sum = partial[0][i];
+      for (int band = 1; band < bands; ++band) sum += partial[band][i];
+      cells[i] = cellFromMoments(sum, width, height);
+    }
+  });
   return cells;
 }
@@ -3,6 +3,7 @@
 
 #include <QVector2D>
 
+class DensityField;
 class IndexMap;
 
 struct VoronoiCell {
@@ -12,7 +13,28 @@ struct VoronoiCell {
   float sumDensity;
 };
 
+// Raw density moments of a cell, summed in double.
+struct Moments {
+  double area;
+  double moment00;
+  double moment10;
+  double moment01;
+  double moment11;
+  double moment20;
+  double moment02;
+
+  // Adds the pixels [begin, end) of row y.
+  void addSpan(const DensityField& density, int32_t y, int32_t begin,
+               int32_t end);
+  Moments& operator+=(const Moments& other);
+};
+
+// Derives centroid and orientation of a cell from its moments, with the
+// centroid normalized by the size of the density field.
+VoronoiCell cellFromMoments(const Moments& moments, int32_t width,
+                            int32_t height);
+
 std::vector<VoronoiCell> accumulateCells(const IndexMap& map,
-                                         const QImage& density);
+                                         const DensityField& density);
 
 #endif  // VORONOICELL_H
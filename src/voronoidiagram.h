@@ -1,12 +1,14 @@
 #ifndef VORONOIDIAGRAM_H
 #define VORONOIDIAGRAM_H
 
-#include <QImage>
-#include <QOffscreenSurface>
-#include <QOpenGLContext>
-#include <QOpenGLFramebufferObject>
-#include <QOpenGLShaderProgram>
-#include <QOpenGLVertexArrayObject>
+#include <memory>
+
+#include <QVector2D>
+#include <QVector>
+
+#include "voronoicell.h"
+
+class DensityField;
 
 class IndexMap {
  public:
@@ -14,33 +16,99 @@ class IndexMap {
   int32_t height;
 
   IndexMap(int32_t w, int32_t h, int32_t count);
+  // Wraps row-major indices owned by someone else without copying them.
+  IndexMap(int32_t w, int32_t h, int32_t count, const uint32_t* data);
   void set(const int32_t x, const int32_t y, const uint32_t value);
   uint32_t get(int32_t x, const int32_t y) const;
   int32_t count() const;
 
+  uint32_t* scanLine(const int32_t y);
+  const uint32_t* constScanLine(const int32_t y) const;
+
  private:
   int32_t m_numEncoded;
   QVector<uint32_t> m_data;
+  const uint32_t* m_external;
+
+  const uint32_t* bits() const;
 };
 
+// Calls f(begin, end, index) for every run of equal indices in a row of an
+// index map. Voronoi cells are convex, so each row of a cell is a single run
+// and its end can be found by galloping instead of comparing every pixel.
+template <class F>
+void forEachSpan(const uint32_t* row, int32_t width, F&& f) {
+  int32_t begin = 0;
+  while (begin < width) {
+    const uint32_t index = row[begin];
+
+    // grow the step until it leaves the run, then bisect the last step
+    int32_t inside = begin;
+    int32_t step = 1;
+    int32_t outside = width;
+    while (inside + step < width) {
+      if (row[inside + step] != index) {
+        outside = inside + step;
+        break;
+      }
+      inside += step;
+      step *= 2;
+    }
+    while (outside - inside > 1) {
+      const int32_t mid = inside + (outside - inside) / 2;
+      if (row[mid] == index) {
+        inside = mid;
+      } else {
+        outside = mid;
+      }
+    }
+
+    f(begin, outside, index);
+    begin = outside;
+  }
+}
+
+// Computes the discrete Voronoi diagram of a set of sites given in normalized
+// [0, 1] coordinates. Every backend produces an index map of the same size as
+// the density field, where each pixel holds the index of its nearest site.
 class VoronoiDiagram {
  public:
-  VoronoiDiagram(QImage& density);
-  ~VoronoiDiagram();
+  enum class Backend { OpenGL, CPU };
 
-  IndexMap calculate(const QVector<QVector2D>& points);
+  // Cost of the last call to calculate() or calculateCells(), times in
+  // wall-clock milliseconds. Fused passes that assign and accumulate at once
+  // count as rasterization.
+  struct Stats {
+    double raster = 0.0;
+    double readback = 0.0;
+    double accumulate = 0.0;
+    // pixels assigned to a site, redrawn pixels count again
+    size_t pixels = 0;
+  };
 
- private:
-  int m_coneVertices;
+  virtual ~VoronoiDiagram() = default;
+
+  virtual IndexMap calculate(const QVector<QVector2D>& points) = 0;
+
+  // Prepares the diagram for another density field, possibly of a different
+  // size, dropping everything derived from the previous one.
+  virtual void reset(const DensityField& density) = 0;
+
+  // Computes the cells of the diagram. Backends that can produce the diagram
+  // row by row override this to accumulate without storing the index map.
+  virtual std::vector<VoronoiCell> calculateCells(
+      const QVector<QVector2D>& points, const DensityField& density);
+
+  const Stats& stats() const { return m_stats; }
+
+  // Host and device memory held by the diagram.
+  virtual size_t bytes() const = 0;
 
-  QOpenGLContext* m_context;
-  QOffscreenSurface* m_surface;
-  QOpenGLVertexArrayObject* m_vao;
-  QOpenGLShaderProgram* m_shaderProgram;
-  QOpenGLFramebufferObject* m_fbo;
-  QImage m_densityMap;
+  static std::unique_ptr<VoronoiDiagram> create(Backend backend,
+                                                const DensityField& density);
 
-  QVector<QVector3D> createConeDrawingData(const QSize& size);
+ protected:
+  Stats m_stats;
 };
 
 #endif  // VORONOIDIAGRAM_H
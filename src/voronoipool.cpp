@@ -0,0 +1,104 @@
+#include "voronoipool.h"
+#include "cpuvoronoidiagram.h"
+#include "densityfield.h"
+#include "glvoronoidiagram.h"
+
+#include <cassert>
+
+#include <QCoreApplication>
+#include <QThread>
+
+VoronoiPool::VoronoiPool(size_t maxIdle) : m_maxIdle(maxIdle) {}
+
+VoronoiPool::~VoronoiPool() { clear(); }
+
+void VoronoiPool::prepareOpenGL() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_glContext) m_glContext = std::make_shared<GLVoronoiContext>();
+}
+
+VoronoiPool::Handle VoronoiPool::acquire(VoronoiDiagram::Backend backend,
+                                         const DensityField& density) {
+  const QSize size = density.size();
+  std::shared_ptr<GLVoronoiContext> glContext;
+  if (backend == VoronoiDiagram::Backend::OpenGL) {
+    glContext = sharedGLContext();
+    if (!glContext) {
+      qWarning("OpenGL needs a surface from the GUI thread, using the CPU.");
+      backend = VoronoiDiagram::Backend::CPU;
+    }
+  }
+  std::unique_ptr<VoronoiDiagram> diagram;
+  bool exact = false;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // prefer the most recently released diagram of the right size
+    auto match = m_idle.end();
+    for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+      if (it->backend != backend) continue;
+      if (it->size == size) {
+        match = it;
+        exact = true;
+      } else if (!exact) {
+        match = it;
+      }
+    }
+    // the shared context can only be made current on its own thread
+    assert(!glContext || !glContext->context() ||
+           glContext->context()->thread() == QThread::currentThread());
+    if (match != m_idle.end()) {
+      diagram = std::move(match->diagram);
+      m_idle.erase(match);
+    }
+  }
+
+  if (diagram) {
+    diagram->reset(density);
+  } else if (backend == VoronoiDiagram::Backend::OpenGL) {
+    diagram = std::make_unique<GLVoronoiDiagram>(density, glContext);
+  } else {
+    diagram = std::make_unique<CPUVoronoiDiagram>(density);
+  }
+
+  return Handle(diagram.release(), [this, backend, size](VoronoiDiagram* d) {
+    release(backend, size, d);
+  });
+}
+
+std::shared_ptr<GLVoronoiContext> VoronoiPool::sharedGLContext() {
+  // Only the GUI thread creates the surface. Other threads do not wait for
+  // it, the GUI thread may not even run an event loop.
+  const QCoreApplication* app = QCoreApplication::instance();
+  const bool guiThread = app && QThread::currentThread() == app->thread();
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!m_glContext && guiThread) {
+    m_glContext = std::make_shared<GLVoronoiContext>();
+  }
+  return m_glContext;
+}
+
+void VoronoiPool::release(VoronoiDiagram::Backend backend, const QSize& size,
+                          VoronoiDiagram* diagram) {
+  std::unique_ptr<VoronoiDiagram> evicted;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.push_back({backend, size, std::unique_ptr<VoronoiDiagram>(diagram)});
+    if (m_idle.size() > m_maxIdle) {
+      evicted = std::move(m_idle.front().diagram);
+      m_idle.erase(m_idle.begin());
+    }
+  }
+  // destroyed outside the lock
+}
+
+void VoronoiPool::clear() {
+  std::vector<Entry> idle;
+  std::shared_ptr<GLVoronoiContext> glContext;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    idle.swap(m_idle);
+    glContext.swap(m_glContext);
+  }
+  // Diagrams still in use keep their own reference to the shared context,
+  // it is destroyed together with the last of them.
+}
@@ -0,0 +1,63 @@
+#ifndef VORONOIPOOL_H
+#define VORONOIPOOL_H
+
+#include "voronoidiagram.h"
+
+#include <QSize>
+
+#include <functional>
+#include <mutex>
+
+class GLVoronoiContext;
+
+// Keeps released Voronoi diagrams alive for later runs. A diagram of the
+// same backend and size is handed out as is, otherwise an idle one of the
+// same backend is reset to the new size before a new one is created. All
+// OpenGL diagrams share one context and shader program, so OpenGL diagrams
+// must be acquired on the thread that acquired the first one, which is
+// asserted. Their surface needs the GUI thread, runs on other threads fall
+// back to the CPU unless prepareOpenGL() was called before.
+//
+// The pool must outlive the handles it hands out.
+class VoronoiPool {
+ public:
+  using Handle =
+      std::unique_ptr<VoronoiDiagram, std::function<void(VoronoiDiagram*)>>;
+
+  explicit VoronoiPool(size_t maxIdle = 4);
+  ~VoronoiPool();
+
+  VoronoiPool(const VoronoiPool&) = delete;
+  VoronoiPool& operator=(const VoronoiPool&) = delete;
+
+  // The diagram returns to the pool when the handle is destroyed.
+  Handle acquire(VoronoiDiagram::Backend backend, const DensityField& density);
+
+  // Creates the shared OpenGL objects that need the GUI thread, must be
+  // called there.
+  void prepareOpenGL();
+
+  // Destroys all idle diagrams and, once no diagram uses them anymore, the
+  // shared OpenGL objects.
+  void clear();
+
+ private:
+  struct Entry {
+    VoronoiDiagram::Backend backend;
+    QSize size;
+    std::unique_ptr<VoronoiDiagram> diagram;
+  };
+
+  size_t m_maxIdle;
+  std::mutex m_mutex;
+  // least recently released first
+  std::vector<Entry> m_idle;
+  std::shared_ptr<GLVoronoiContext> m_glContext;
+
+  // Null if they do not exist yet and this is not the GUI thread.
+  std::shared_ptr<GLVoronoiContext> sharedGLContext();
+  void release(VoronoiDiagram::Backend backend, const QSize& size,
+               VoronoiDiagram* diagram);
+};
+
+#endif  // VORONOIPOOL_H